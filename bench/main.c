@@ -0,0 +1,481 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Copyright 2017 Jason King
+ */
+
+/*
+ * Micro-benchmarks for libsysdemangle.  Run with no arguments to run all
+ * of them, or with the names of the ones to run.  With -f file, the
+ * symbols in file (one per line) are also used by the corpus benchmarks.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "sysdemangle.h"
+#include "tests.h"
+
+extern test_list_t *gcc_libstdc;
+extern test_list_t *llvm_pass_list;
+
+/*
+ * Roughly how many bytes of output to generate for each measurement, which
+ * is split into BENCH_ROUNDS rounds.  The fastest round is reported to
+ * filter out noise from other activity on the system.
+ */
+#define	BENCH_TOTAL_OUT	(8U * 1024U * 1024U)
+#define	BENCH_ROUNDS	5
+
+static const char **file_syms;
+static size_t file_nsyms;
+static const char *file_name;
+
+typedef struct bench_s {
+	const char	*b_name;
+	const char	*b_desc;
+	void		(*b_fn)(void);
+} bench_t;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * A growable, NUL-terminated string used to build the mangled names.
+ */
+typedef struct buf_s {
+	char	*b_s;
+	size_t	b_len;
+	size_t	b_size;
+} buf_t;
+
+static void
+buf_printf(buf_t *b, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+buf_printf(buf_t *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->b_s + b->b_len, b->b_size - b->b_len, fmt, ap);
+		va_end(ap);
+
+		if (n >= 0 && (size_t)n < b->b_size - b->b_len)
+			break;
+
+		b->b_size = (b->b_size == 0) ? 256 : b->b_size * 2;
+		if ((b->b_s = realloc(b->b_s, b->b_size)) == NULL) {
+			(void) fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	b->b_len += n;
+}
+
+/*
+ * Demangle name repeatedly (enough times to produce about BENCH_TOTAL_OUT
+ * bytes of output) and print the time per output byte.
+ */
+static void
+bench_one(const char *label, const char *name)
+{
+	size_t len = strlen(name);
+	size_t outlen, iters;
+	uint64_t best = UINT64_MAX;
+	char *res;
+
+	if ((res = sysdemangle_n(name, len, SYSDEM_LANG_CPP, NULL)) == NULL) {
+		(void) printf("%-24s error: %s\n", label, strerror(errno));
+		return;
+	}
+	outlen = strlen(res);
+	free(res);
+
+	iters = BENCH_TOTAL_OUT / BENCH_ROUNDS / outlen;
+	if (iters < 1)
+		iters = 1;
+
+	for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+		uint64_t start = now_ns();
+
+		for (size_t i = 0; i < iters; i++)
+			free(sysdemangle_n(name, len, SYSDEM_LANG_CPP, NULL));
+
+		uint64_t t = now_ns() - start;
+
+		if (t < best)
+			best = t;
+	}
+
+	(void) printf("%-24s %8zu bytes out %10.2f ns/call %7.3f ns/byte\n",
+	    label, outlen, (double)best / iters, (double)best / iters / outlen);
+}
+
+/*
+ * f(n00000, n00001, ...) -- a long flat parameter list.  Each parameter
+ * adds 8 bytes of output.
+ */
+static void
+gen_params(buf_t *b, size_t outlen)
+{
+	b->b_len = 0;
+	buf_printf(b, "_Z1f");
+	for (size_t i = 0; i * 8 < outlen; i++)
+		buf_printf(b, "6n%05zu", i % 100000);
+}
+
+/*
+ * f(A<B<C<D<n00000> > > >, ...) -- parameters that are nested templates,
+ * with the leaf names distinct so nothing is a substitution candidate.
+ */
+static void
+gen_templates(buf_t *b, size_t outlen)
+{
+	b->b_len = 0;
+	buf_printf(b, "_Z1f");
+	for (size_t i = 0; i * 26 < outlen; i++)
+		buf_printf(b, "1AI1BI1CI1DI6n%05zuEEEE", i % 100000);
+}
+
+/*
+ * f(void (* (* (* ...)())())()) -- a pointer to a function returning a
+ * pointer to a function returning ... void.  Each level is parsed as the
+ * return type of the next one, so the right hand side of the type (the
+ * ")()" pieces) is prepended to at every level.  Each level adds 6 bytes
+ * of output.
+ */
+static void
+gen_fnptrs(buf_t *b, size_t outlen)
+{
+	size_t n = outlen / 6;
+
+	b->b_len = 0;
+	buf_printf(b, "_Z1f");
+	for (size_t i = 0; i < n; i++)
+		buf_printf(b, "PF");
+	buf_printf(b, "v");
+	for (size_t i = 0; i < n; i++)
+		buf_printf(b, "vE");
+}
+
+static void
+bench_scale(void)
+{
+	static const size_t sizes[] = { 100, 1000, 10000, 100000 };
+	buf_t b = { 0 };
+	char label[32];
+
+	for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		gen_params(&b, sizes[i]);
+		(void) snprintf(label, sizeof (label), "params/%zu", sizes[i]);
+		bench_one(label, b.b_s);
+	}
+
+	for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		gen_templates(&b, sizes[i]);
+		(void) snprintf(label, sizeof (label), "templates/%zu",
+		    sizes[i]);
+		bench_one(label, b.b_s);
+	}
+
+	/* these nest one parse_type() call per level, so stay shallower */
+	for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]) - 1; i++) {
+		gen_fnptrs(&b, sizes[i]);
+		(void) snprintf(label, sizeof (label), "fnptrs/%zu", sizes[i]);
+		bench_one(label, b.b_s);
+	}
+
+	free(b.b_s);
+}
+
+/*
+ * Demangle each of syms once per round, and report the best average time
+ * per symbol, both with sysdemangle() and with a reused sysdem_ctx_t.  The
+ * context's counters for a single pass over syms are also reported.
+ */
+static void
+bench_syms(const char *label, const char **syms, size_t n)
+{
+	sysdem_ctx_t *ctx = sysdem_ctx_create(NULL);
+	sysdem_stats_t stats;
+	uint64_t best = UINT64_MAX, best_ctx = UINT64_MAX;
+	size_t *lens = calloc(n, sizeof (size_t));
+	char *buf = malloc(65536);
+
+	if (n == 0 || ctx == NULL || lens == NULL || buf == NULL) {
+		(void) printf("%-24s skipped\n", label);
+		goto done;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		lens[i] = strlen(syms[i]);
+
+	for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+		uint64_t start = now_ns();
+
+		for (size_t i = 0; i < n; i++)
+			free(sysdemangle_n(syms[i], lens[i], SYSDEM_LANG_CPP,
+			    NULL));
+
+		uint64_t t = now_ns() - start;
+
+		if (t < best)
+			best = t;
+
+		start = now_ns();
+		for (size_t i = 0; i < n; i++) {
+			size_t len = 65536;
+
+			(void) sysdemangle_ctx_r(ctx, syms[i], lens[i],
+			    SYSDEM_LANG_CPP, buf, &len);
+		}
+
+		t = now_ns() - start;
+
+		if (t < best_ctx)
+			best_ctx = t;
+	}
+
+	(void) printf("%-24s %8zu symbols %9.1f ns/sym %9.1f ns/sym (ctx)\n",
+	    label, n, (double)best / n, (double)best_ctx / n);
+
+	sysdem_ctx_stats(ctx, &stats);
+	(void) printf("%-24s %8" PRIu64 " forward refs %5" PRIu64 " reparsed\n",
+	    "", stats.st_fwd_refs / BENCH_ROUNDS,
+	    stats.st_reparsed / BENCH_ROUNDS);
+
+done:
+	sysdem_ctx_destroy(ctx);
+	free(lens);
+	free(buf);
+}
+
+static void
+bench_list(test_list_t *tl)
+{
+	const char **syms = calloc(tl->ntests + 1, sizeof (char *));
+
+	if (syms == NULL)
+		return;
+
+	for (size_t i = 0; i < tl->ntests; i++)
+		syms[i] = tl->tests[i].mangled;
+
+	bench_syms(tl->desc, syms, tl->ntests);
+	free(syms);
+}
+
+static void
+bench_corpus(void)
+{
+	bench_list(gcc_libstdc);
+	bench_list(llvm_pass_list);
+
+	if (file_name != NULL)
+		bench_syms(file_name, file_syms, file_nsyms);
+}
+
+/*
+ * The symbols from the test lists that use operator names or expressions
+ * (approximated by looking at the expected output), which are what
+ * parse_operator_name() and parse_expression() are used for.
+ */
+static void
+bench_expr(void)
+{
+	static const char *words[] = { "operator", "decltype", "sizeof" };
+	test_list_t *lists[] = { gcc_libstdc, llvm_pass_list };
+	size_t nlists = sizeof (lists) / sizeof (lists[0]);
+	size_t nwords = sizeof (words) / sizeof (words[0]);
+	const char **syms;
+	size_t n = 0, max = 0;
+
+	for (size_t i = 0; i < nlists; i++)
+		max += lists[i]->ntests;
+
+	if ((syms = calloc(max + 1, sizeof (char *))) == NULL)
+		return;
+
+	for (size_t i = 0; i < nlists; i++) {
+		for (size_t j = 0; j < lists[i]->ntests; j++) {
+			const test_t *t = &lists[i]->tests[j];
+
+			for (size_t k = 0; k < nwords; k++) {
+				if (strstr(t->demangled, words[k]) != NULL) {
+					syms[n++] = t->mangled;
+					break;
+				}
+			}
+		}
+	}
+
+	bench_syms("operators/expressions", syms, n);
+	free(syms);
+}
+
+/*
+ * Time per symbol over the gcc list when looked up in a sysdem_cache_t that
+ * already holds all of them, compared with demangling them each time.
+ */
+static void
+bench_cache(void)
+{
+	sysdem_cache_t *cache = sysdem_cache_create(NULL, 0, 0);
+	test_list_t *tl = gcc_libstdc;
+	sysdem_cache_stats_t stats;
+	uint64_t best = UINT64_MAX, best_cache = UINT64_MAX;
+	size_t n = tl->ntests;
+	char *buf = malloc(65536);
+
+	if (n == 0 || cache == NULL || buf == NULL) {
+		(void) printf("%-24s skipped\n", "cache");
+		goto done;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		free(sysdemangle_cache(cache, tl->tests[i].mangled,
+		    strlen(tl->tests[i].mangled), SYSDEM_LANG_CPP));
+
+	for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+		uint64_t start = now_ns();
+
+		for (size_t i = 0; i < n; i++) {
+			const char *s = tl->tests[i].mangled;
+			size_t len = 65536;
+
+			(void) sysdemangle_n_r(s, strlen(s), SYSDEM_LANG_CPP,
+			    buf, &len, NULL);
+		}
+
+		uint64_t t = now_ns() - start;
+
+		if (t < best)
+			best = t;
+
+		start = now_ns();
+		for (size_t i = 0; i < n; i++) {
+			const char *s = tl->tests[i].mangled;
+			size_t len = 65536;
+
+			(void) sysdemangle_cache_r(cache, s, strlen(s),
+			    SYSDEM_LANG_CPP, buf, &len);
+		}
+
+		t = now_ns() - start;
+
+		if (t < best_cache)
+			best_cache = t;
+	}
+
+	sysdem_cache_stats(cache, &stats);
+	(void) printf("%-24s %8zu symbols %9.1f ns/sym %9.1f ns/sym (cache)\n",
+	    tl->desc, n, (double)best / n, (double)best_cache / n);
+	(void) printf("%-24s %8" PRIu64 " hits %9" PRIu64 " misses %zu bytes\n",
+	    "", stats.cs_hits, stats.cs_misses, stats.cs_bytes);
+
+done:
+	sysdem_cache_destroy(cache);
+	free(buf);
+}
+
+static void
+load_file(const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char line[65536];
+	size_t size = 0;
+
+	if (f == NULL) {
+		(void) fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	while (fgets(line, sizeof (line), f) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (file_nsyms == size) {
+			size = (size == 0) ? 1024 : size * 2;
+			file_syms = realloc(file_syms, size * sizeof (char *));
+			if (file_syms == NULL) {
+				(void) fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+
+		if ((file_syms[file_nsyms++] = strdup(line)) == NULL) {
+			(void) fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+
+	(void) fclose(f);
+	file_name = name;
+}
+
+static bench_t benches[] = {
+	{ "scale", "time per output byte as the demangled name grows",
+	    bench_scale },
+	{ "corpus", "time per symbol over the test corpora",
+	    bench_corpus },
+	{ "expr", "time per symbol for symbols with operators or expressions",
+	    bench_expr },
+	{ "cache", "time per symbol when every lookup hits in the cache",
+	    bench_cache },
+};
+
+int
+main(int argc, const char *argv[])
+{
+	size_t nbench = sizeof (benches) / sizeof (benches[0]);
+
+	if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+		load_file(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+
+	for (size_t i = 0; i < nbench; i++) {
+		if (argc > 1) {
+			int j;
+
+			for (j = 1; j < argc; j++) {
+				if (strcmp(argv[j], benches[i].b_name) == 0)
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+
+		(void) printf("# %s: %s\n", benches[i].b_name,
+		    benches[i].b_desc);
+		benches[i].b_fn();
+		(void) printf("\n");
+	}
+
+	return (0);
+}
@@ -0,0 +1,800 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Copyright 2017 Jason King
+ */
+
+/*
+ * sysdemangle [-f] [-j nthreads] [name | file ...]
+ *
+ * A c++filt(1) compatible filter.  With no operands, stdin is copied to
+ * stdout with every mangled name in it replaced by its demangled form.
+ * With operands, each one is demangled and printed on its own line (or
+ * printed unchanged if it isn't a mangled name), as c++filt does.  With
+ * -f, the operands are instead files to filter ("-" is stdin).
+ *
+ * As in c++filt, a mangled name is a whole token of symbol characters
+ * (letters, digits, '_', '$' and '.') starting with _Z or ___Z.  Tokens
+ * that fail to demangle are left alone.
+ *
+ * The input is read in large blocks and scanned for "_Z" 16 bytes at a
+ * time.  The text between the names is never copied: the output is
+ * gathered as a list of pointers into the input block and the demangled
+ * names, and written with writev(2) once per block.
+ *
+ * With -j, the filtering is spread over nthreads worker threads, each with
+ * its own context.  The main thread reads the input into large chunks that
+ * end on a line boundary and queues them.  A worker filters a chunk into
+ * an output buffer of its own, and a writer thread writes the buffers out
+ * in the order their chunks were read, so the output is the same as with
+ * a single thread.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sysdemangle.h"
+
+#ifndef FILT_BUFSZ
+#define	FILT_BUFSZ	(1024U * 1024U)	/* initial size of an input block */
+#endif
+#ifndef FILT_NAMESZ
+#define	FILT_NAMESZ	(256U * 1024U)	/* initial space for demangled names */
+#endif
+#define	FILT_NIOV	512
+#define	FILT_CHUNKS_PER_THREAD	4	/* chunks in flight per worker */
+
+typedef struct out_s {
+	int		o_fd;		/* -1 to append the output to o_data */
+	struct iovec	o_iov[FILT_NIOV];
+	int		o_niov;
+	char		*o_names;	/* demangled names o_iov points into */
+	size_t		o_namelen;
+	size_t		o_namesz;
+	char		*o_data;
+	size_t		o_datalen;
+	size_t		o_datasz;
+} out_t;
+
+typedef struct chunk_s {
+	struct chunk_s	*c_next;
+	size_t		c_seq;		/* order the chunk was read in */
+	char		*c_buf;		/* input, ending on a line boundary */
+	size_t		c_len;
+	size_t		c_bufsz;
+	char		*c_out;		/* filtered output */
+	size_t		c_outlen;
+	size_t		c_outsz;
+} chunk_t;
+
+struct pipeline_s;
+
+typedef struct worker_s {
+	struct pipeline_s *w_pipe;
+	pthread_t	w_tid;
+	sysdem_ctx_t	*w_ctx;
+	out_t		w_out;
+} worker_t;
+
+/*
+ * A chunk is either held by the reader (p_cur), queued for the workers
+ * (p_work), held by a worker, waiting to be written (p_done), held by the
+ * writer, or free.  At most p_nchunks exist, so a chunk waiting to be
+ * written is kept at p_done[c_seq % p_nchunks].
+ */
+typedef struct pipeline_s {
+	pthread_mutex_t	p_lock;
+	pthread_cond_t	p_free_cv;
+	pthread_cond_t	p_work_cv;
+	pthread_cond_t	p_done_cv;
+	chunk_t		*p_chunks;
+	size_t		p_nchunks;
+	chunk_t		*p_free;
+	chunk_t		*p_work;
+	chunk_t		*p_worktail;
+	chunk_t		**p_done;
+	size_t		p_seq;		/* sequence of the next chunk queued */
+	size_t		p_next;		/* sequence of the next chunk written */
+	int		p_eof;
+	chunk_t		*p_cur;
+	char		*p_carry;	/* partial line read after a chunk */
+	size_t		p_carrysz;
+	worker_t	*p_workers;
+	int		p_nworkers;
+	pthread_t	p_writer;
+	int		p_fd;
+} pipeline_t;
+
+typedef struct filt_s {
+	sysdem_ctx_t	*f_ctx;
+	out_t		f_out;
+	char		*f_buf;
+	size_t		f_bufsz;
+	pipeline_t	*f_pipe;
+} filt_t;
+
+static unsigned char symch[256];
+
+static void
+init_symch(void)
+{
+	for (int c = 0; c < 256; c++) {
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') || c == '_' || c == '$' || c == '.')
+			symch[c] = 1;
+	}
+}
+
+#define	IS_SYMCH(c)	(symch[(unsigned char)(c)] != 0)
+
+static void *
+xmalloc(size_t len)
+{
+	void *p = malloc(len);
+
+	if (p == NULL)
+		err(EXIT_FAILURE, "out of memory");
+	return (p);
+}
+
+static void *
+xrealloc(void *p, size_t len)
+{
+	if ((p = realloc(p, len)) == NULL)
+		err(EXIT_FAILURE, "out of memory");
+	return (p);
+}
+
+static void
+write_all(int fd, const char *p, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "write");
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/* Append the queued output to o_data */
+static void
+out_collect(out_t *o)
+{
+	size_t need = o->o_datalen;
+
+	for (int i = 0; i < o->o_niov; i++)
+		need += o->o_iov[i].iov_len;
+
+	if (need > o->o_datasz) {
+		size_t sz = (o->o_datasz > 0) ? o->o_datasz * 2 : FILT_BUFSZ;
+
+		while (sz < need)
+			sz *= 2;
+		o->o_data = xrealloc(o->o_data, sz);
+		o->o_datasz = sz;
+	}
+
+	for (int i = 0; i < o->o_niov; i++) {
+		(void) memcpy(o->o_data + o->o_datalen, o->o_iov[i].iov_base,
+		    o->o_iov[i].iov_len);
+		o->o_datalen += o->o_iov[i].iov_len;
+	}
+}
+
+static void
+out_flush(out_t *o)
+{
+	struct iovec *iov = o->o_iov;
+	int niov = o->o_niov;
+
+	if (o->o_fd < 0) {
+		out_collect(o);
+		niov = 0;
+	}
+
+	while (niov > 0) {
+		ssize_t n = writev(o->o_fd, iov, niov);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "write");
+		}
+
+		/* skip past what was written, then retry the rest */
+		while (niov > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	o->o_niov = 0;
+	o->o_namelen = 0;
+}
+
+static void
+out_add(out_t *o, const char *p, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (o->o_niov > 0) {
+		struct iovec *last = &o->o_iov[o->o_niov - 1];
+
+		if ((char *)last->iov_base + last->iov_len == p) {
+			last->iov_len += len;
+			return;
+		}
+	}
+
+	if (o->o_niov == FILT_NIOV)
+		out_flush(o);
+
+	o->o_iov[o->o_niov].iov_base = (void *)p;
+	o->o_iov[o->o_niov].iov_len = len;
+	o->o_niov++;
+}
+
+/*
+ * Demangle [p, p + len) into the name space of o and queue it.  Returns
+ * 0 if it isn't a mangled name (nothing is queued then).
+ */
+static int
+out_demangle(sysdem_ctx_t *ctx, out_t *o, const char *p, size_t len)
+{
+	/* flushing resets o_names, so it can't happen once a name is in it */
+	if (o->o_niov == FILT_NIOV)
+		out_flush(o);
+
+	for (;;) {
+		size_t avail = o->o_namesz - o->o_namelen;
+		char *dst = o->o_names + o->o_namelen;
+		int ret;
+
+		ret = sysdemangle_ctx_r(ctx, p, len, SYSDEM_LANG_CPP, dst,
+		    &avail);
+		if (ret == 0) {
+			/* avail is now the length including the NUL */
+			out_add(o, dst, avail - 1);
+			o->o_namelen += avail - 1;
+			return (1);
+		}
+
+		if (ret != ERANGE)
+			return (0);
+
+		/* queued names point into o_names, so write them out first */
+		out_flush(o);
+
+		if (avail > o->o_namesz) {
+			o->o_names = xrealloc(o->o_names, avail);
+			o->o_namesz = avail;
+		}
+	}
+}
+
+/* Return the first "_Z" in [p, end), or NULL */
+static const char *
+find_z(const char *p, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i under = _mm_set1_epi8('_');
+	const __m128i zed = _mm_set1_epi8('Z');
+
+	/* compare each byte with '_' and the byte after it with 'Z' */
+	while (end - p > 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+		int mask = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(a, under), _mm_cmpeq_epi8(b, zed)));
+
+		if (mask != 0)
+			return (p + __builtin_ctz(mask));
+		p += 16;
+	}
+#endif
+
+	while (p < end && (p = memchr(p, '_', end - p)) != NULL) {
+		if (p + 1 < end && p[1] == 'Z')
+			return (p);
+		p++;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Filter [buf, end) into o.  buf must be the start of a token; end must be
+ * the end of one.
+ */
+static void
+filter(sysdem_ctx_t *ctx, out_t *o, const char *buf, const char *end)
+{
+	const char *start = buf;	/* start of the text to copy out */
+	const char *p = buf;
+	const char *z;
+
+	while ((z = find_z(p, end)) != NULL) {
+		const char *tok = z;
+		const char *tend;
+
+		if (z - buf >= 2 && z[-1] == '_' && z[-2] == '_')
+			tok = z - 2;
+
+		/* only whole tokens are names */
+		if (tok > buf && IS_SYMCH(tok[-1])) {
+			p = z + 2;
+			continue;
+		}
+
+		for (tend = z + 2; tend < end && IS_SYMCH(*tend); tend++)
+			;
+
+		out_add(o, start, tok - start);
+		if (out_demangle(ctx, o, tok, tend - tok))
+			start = tend;
+		else
+			start = tok;
+
+		p = tend;
+	}
+
+	out_add(o, start, end - start);
+}
+
+/* Filter everything read from fd to f's output */
+static int
+filter_fd(filt_t *f, int fd, const char *name)
+{
+	size_t have = 0;
+
+	for (;;) {
+		ssize_t n = read(fd, f->f_buf + have, f->f_bufsz - have);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("%s", name);
+			return (-1);
+		}
+
+		if (n == 0) {
+			filter(f->f_ctx, &f->f_out, f->f_buf, f->f_buf + have);
+			out_flush(&f->f_out);
+			return (0);
+		}
+
+		have += n;
+
+		/* only the part up to the last complete token is done now */
+		const char *end = f->f_buf + have;
+
+		while (end > f->f_buf && IS_SYMCH(end[-1]))
+			end--;
+
+		if (end == f->f_buf) {
+			if (have == f->f_bufsz) {
+				f->f_bufsz *= 2;
+				f->f_buf = xrealloc(f->f_buf, f->f_bufsz);
+			}
+			continue;
+		}
+
+		filter(f->f_ctx, &f->f_out, f->f_buf, end);
+		out_flush(&f->f_out);
+
+		have -= end - f->f_buf;
+		(void) memmove(f->f_buf, end, have);
+	}
+}
+
+static void *
+worker_main(void *arg)
+{
+	worker_t *w = arg;
+	pipeline_t *p = w->w_pipe;
+	out_t *o = &w->w_out;
+
+	for (;;) {
+		chunk_t *c;
+
+		(void) pthread_mutex_lock(&p->p_lock);
+		while (p->p_work == NULL && !p->p_eof)
+			(void) pthread_cond_wait(&p->p_work_cv, &p->p_lock);
+		if ((c = p->p_work) == NULL) {
+			(void) pthread_mutex_unlock(&p->p_lock);
+			return (NULL);
+		}
+		if ((p->p_work = c->c_next) == NULL)
+			p->p_worktail = NULL;
+		(void) pthread_mutex_unlock(&p->p_lock);
+
+		/* the chunk's output buffer is reused from its last trip */
+		o->o_data = c->c_out;
+		o->o_datasz = c->c_outsz;
+		o->o_datalen = 0;
+		filter(w->w_ctx, o, c->c_buf, c->c_buf + c->c_len);
+		out_flush(o);
+		c->c_out = o->o_data;
+		c->c_outsz = o->o_datasz;
+		c->c_outlen = o->o_datalen;
+
+		(void) pthread_mutex_lock(&p->p_lock);
+		p->p_done[c->c_seq % p->p_nchunks] = c;
+		if (c->c_seq == p->p_next)
+			(void) pthread_cond_signal(&p->p_done_cv);
+		(void) pthread_mutex_unlock(&p->p_lock);
+	}
+}
+
+static void *
+writer_main(void *arg)
+{
+	pipeline_t *p = arg;
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	for (;;) {
+		chunk_t **cp = &p->p_done[p->p_next % p->p_nchunks];
+		chunk_t *c;
+
+		if ((c = *cp) == NULL) {
+			if (p->p_eof && p->p_next == p->p_seq)
+				break;
+			(void) pthread_cond_wait(&p->p_done_cv, &p->p_lock);
+			continue;
+		}
+		*cp = NULL;
+		(void) pthread_mutex_unlock(&p->p_lock);
+
+		write_all(p->p_fd, c->c_out, c->c_outlen);
+
+		(void) pthread_mutex_lock(&p->p_lock);
+		p->p_next++;
+		c->c_next = p->p_free;
+		p->p_free = c;
+		(void) pthread_cond_signal(&p->p_free_cv);
+	}
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	return (NULL);
+}
+
+static pipeline_t *
+pipe_create(int nworkers, int fd)
+{
+	pipeline_t *p = xmalloc(sizeof (*p));
+	int ret;
+
+	(void) memset(p, 0, sizeof (*p));
+	(void) pthread_mutex_init(&p->p_lock, NULL);
+	(void) pthread_cond_init(&p->p_free_cv, NULL);
+	(void) pthread_cond_init(&p->p_work_cv, NULL);
+	(void) pthread_cond_init(&p->p_done_cv, NULL);
+	p->p_fd = fd;
+
+	p->p_nchunks = (size_t)nworkers * FILT_CHUNKS_PER_THREAD;
+	p->p_chunks = xmalloc(p->p_nchunks * sizeof (chunk_t));
+	p->p_done = xmalloc(p->p_nchunks * sizeof (chunk_t *));
+	(void) memset(p->p_chunks, 0, p->p_nchunks * sizeof (chunk_t));
+	(void) memset(p->p_done, 0, p->p_nchunks * sizeof (chunk_t *));
+	for (size_t i = 0; i < p->p_nchunks; i++) {
+		chunk_t *c = &p->p_chunks[i];
+
+		c->c_bufsz = FILT_BUFSZ;
+		c->c_buf = xmalloc(c->c_bufsz);
+		c->c_next = p->p_free;
+		p->p_free = c;
+	}
+
+	p->p_nworkers = nworkers;
+	p->p_workers = xmalloc(nworkers * sizeof (worker_t));
+	(void) memset(p->p_workers, 0, nworkers * sizeof (worker_t));
+	for (int i = 0; i < nworkers; i++) {
+		worker_t *w = &p->p_workers[i];
+
+		w->w_pipe = p;
+		w->w_out.o_fd = -1;
+		w->w_out.o_namesz = FILT_NAMESZ;
+		w->w_out.o_names = xmalloc(w->w_out.o_namesz);
+		if ((w->w_ctx = sysdem_ctx_create(NULL)) == NULL)
+			err(EXIT_FAILURE, "out of memory");
+		if ((ret = pthread_create(&w->w_tid, NULL, worker_main,
+		    w)) != 0) {
+			errno = ret;
+			err(EXIT_FAILURE, "pthread_create");
+		}
+	}
+
+	if ((ret = pthread_create(&p->p_writer, NULL, writer_main, p)) != 0) {
+		errno = ret;
+		err(EXIT_FAILURE, "pthread_create");
+	}
+
+	return (p);
+}
+
+/* Queue the chunk being read for the workers */
+static void
+pipe_submit(pipeline_t *p)
+{
+	chunk_t *c = p->p_cur;
+
+	p->p_cur = NULL;
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	c->c_seq = p->p_seq++;
+	c->c_next = NULL;
+	if (p->p_worktail != NULL)
+		p->p_worktail->c_next = c;
+	else
+		p->p_work = c;
+	p->p_worktail = c;
+	(void) pthread_cond_signal(&p->p_work_cv);
+	(void) pthread_mutex_unlock(&p->p_lock);
+}
+
+/* Get a free chunk to read into, starting with any carried partial line */
+static chunk_t *
+pipe_chunk(pipeline_t *p, size_t carry)
+{
+	chunk_t *c;
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	while ((c = p->p_free) == NULL)
+		(void) pthread_cond_wait(&p->p_free_cv, &p->p_lock);
+	p->p_free = c->c_next;
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	if (c->c_bufsz <= carry) {
+		while (c->c_bufsz <= carry)
+			c->c_bufsz *= 2;
+		c->c_buf = xrealloc(c->c_buf, c->c_bufsz);
+	}
+
+	if (carry > 0)
+		(void) memcpy(c->c_buf, p->p_carry, carry);
+	c->c_len = carry;
+	return (c);
+}
+
+/*
+ * Read everything from fd into chunks that end on a line boundary and
+ * queue them.  The last chunk of a file is queued as is.
+ */
+static int
+pipe_fd(pipeline_t *p, int fd, const char *name)
+{
+	size_t carry = 0;
+	int ret = 0;
+
+	for (;;) {
+		chunk_t *c;
+		const char *nl;
+		ssize_t n;
+
+		if (p->p_cur == NULL)
+			p->p_cur = pipe_chunk(p, carry);
+		c = p->p_cur;
+
+		if (c->c_len == c->c_bufsz) {
+			c->c_bufsz *= 2;
+			c->c_buf = xrealloc(c->c_buf, c->c_bufsz);
+		}
+
+		n = read(fd, c->c_buf + c->c_len, c->c_bufsz - c->c_len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("%s", name);
+			ret = -1;
+			n = 0;
+		}
+
+		if (n == 0) {
+			if (c->c_len > 0)
+				pipe_submit(p);
+			return (ret);
+		}
+
+		/* only split chunks once they're full */
+		c->c_len += n;
+		if (c->c_len < c->c_bufsz)
+			continue;
+
+		for (nl = c->c_buf + c->c_len; nl > c->c_buf; nl--) {
+			if (nl[-1] == '\n')
+				break;
+		}
+		if (nl == c->c_buf)
+			continue;
+
+		carry = c->c_buf + c->c_len - nl;
+		if (carry > p->p_carrysz) {
+			p->p_carrysz = c->c_bufsz;
+			p->p_carry = xrealloc(p->p_carry, p->p_carrysz);
+		}
+		(void) memcpy(p->p_carry, nl, carry);
+		c->c_len -= carry;
+		pipe_submit(p);
+	}
+}
+
+/* Wait for everything queued to be written, then tear p down */
+static void
+pipe_destroy(pipeline_t *p)
+{
+	(void) pthread_mutex_lock(&p->p_lock);
+	p->p_eof = 1;
+	(void) pthread_cond_broadcast(&p->p_work_cv);
+	(void) pthread_cond_signal(&p->p_done_cv);
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	for (int i = 0; i < p->p_nworkers; i++) {
+		worker_t *w = &p->p_workers[i];
+
+		(void) pthread_join(w->w_tid, NULL);
+		sysdem_ctx_destroy(w->w_ctx);
+		free(w->w_out.o_names);
+	}
+	(void) pthread_join(p->p_writer, NULL);
+
+	for (size_t i = 0; i < p->p_nchunks; i++) {
+		free(p->p_chunks[i].c_buf);
+		free(p->p_chunks[i].c_out);
+	}
+
+	(void) pthread_cond_destroy(&p->p_free_cv);
+	(void) pthread_cond_destroy(&p->p_work_cv);
+	(void) pthread_cond_destroy(&p->p_done_cv);
+	(void) pthread_mutex_destroy(&p->p_lock);
+	free(p->p_workers);
+	free(p->p_chunks);
+	free(p->p_done);
+	free(p->p_carry);
+	free(p);
+}
+
+static int
+filter_input(filt_t *f, int fd, const char *name)
+{
+	if (f->f_pipe != NULL)
+		return (pipe_fd(f->f_pipe, fd, name));
+	return (filter_fd(f, fd, name));
+}
+
+static int
+filter_file(filt_t *f, const char *path)
+{
+	int fd, ret;
+
+	if (strcmp(path, "-") == 0)
+		return (filter_input(f, STDIN_FILENO, "stdin"));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		warn("%s", path);
+		return (-1);
+	}
+
+	ret = filter_input(f, fd, path);
+	(void) close(fd);
+	return (ret);
+}
+
+/* Like c++filt, demangle each operand by itself */
+static int
+demangle_args(sysdem_ctx_t *ctx, int argc, char **argv)
+{
+	for (int i = 0; i < argc; i++) {
+		char *res = sysdemangle_ctx(ctx, argv[i], strlen(argv[i]),
+		    SYSDEM_LANG_AUTO);
+
+		(void) printf("%s\n", (res != NULL) ? res : argv[i]);
+		free(res);
+	}
+
+	return ((fflush(stdout) == 0) ? 0 : -1);
+}
+
+static void
+usage(const char *name)
+{
+	(void) fprintf(stderr, "Usage: %s [-f] [-j nthreads] [name | file ...]\n",
+	    name);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	filt_t f = { 0 };
+	int files = 0;
+	int nthreads = 1;
+	int c, ret = 0;
+	char *end;
+	long val;
+
+	while ((c = getopt(argc, argv, "fj:")) != -1) {
+		switch (c) {
+		case 'f':
+			files = 1;
+			break;
+		case 'j':
+			errno = 0;
+			val = strtol(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' || val < 1 || val > 1024)
+				errx(2, "invalid thread count: %s", optarg);
+			nthreads = (int)val;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((f.f_ctx = sysdem_ctx_create(NULL)) == NULL)
+		err(EXIT_FAILURE, "out of memory");
+
+	if (argc > 0 && !files) {
+		ret = demangle_args(f.f_ctx, argc, argv);
+		sysdem_ctx_destroy(f.f_ctx);
+		return ((ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	init_symch();
+	if (nthreads > 1) {
+		f.f_pipe = pipe_create(nthreads, STDOUT_FILENO);
+	} else {
+		f.f_out.o_fd = STDOUT_FILENO;
+		f.f_out.o_namesz = FILT_NAMESZ;
+		f.f_bufsz = FILT_BUFSZ;
+		f.f_out.o_names = xmalloc(f.f_out.o_namesz);
+		f.f_buf = xmalloc(f.f_bufsz);
+	}
+
+	if (argc == 0) {
+		ret = filter_input(&f, STDIN_FILENO, "stdin");
+	} else {
+		for (int i = 0; i < argc; i++) {
+			if (filter_file(&f, argv[i]) != 0)
+				ret = -1;
+		}
+	}
+
+	if (f.f_pipe != NULL)
+		pipe_destroy(f.f_pipe);
+	free(f.f_buf);
+	free(f.f_out.o_names);
+	sysdem_ctx_destroy(f.f_ctx);
+	return ((ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
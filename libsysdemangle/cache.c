@@ -0,0 +1,435 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Copyright 2017 Jason King
+ */
+
+/*
+ * A cache of demangled names, keyed by the mangled name (and the language
+ * it was demangled as).  The cache is split into a power of two number of
+ * shards, each with its own lock, hash table, LRU list and share of the
+ * memory budget, and a name always maps to the same shard.  Threads looking
+ * up different names will usually not contend with each other, and nothing
+ * ever takes more than one shard's lock at a time.
+ *
+ * Names are demangled without holding any lock, so two threads missing on
+ * the same name at once will both demangle it; the second one to finish
+ * just uses the entry the first one inserted.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include "sysdemangle.h"
+#include "sysdemangle_int.h"
+
+#define	CACHE_BUDGET		(4U * 1024U * 1024U)
+#define	CACHE_NSHARDS		(16U)
+#define	CACHE_MIN_BUCKETS	(64U)
+
+typedef struct cache_ent_s {
+	struct cache_ent_s	*ce_next;	/* next in the hash chain */
+	struct cache_ent_s	*ce_lru_prev;	/* more recently used */
+	struct cache_ent_s	*ce_lru_next;	/* less recently used */
+	uint64_t		ce_hash;
+	sysdem_lang_t		ce_lang;
+	size_t			ce_keylen;
+	size_t			ce_len;		/* of the demangled name */
+	char			ce_data[];	/* key, then the name + NUL */
+} cache_ent_t;
+
+#define	CE_SIZE(keylen, len)	(sizeof (cache_ent_t) + (keylen) + (len) + 1)
+#define	CE_NAME(ce)		((ce)->ce_data + (ce)->ce_keylen)
+
+typedef struct cache_shard_s {
+	pthread_mutex_t	sh_lock;
+	cache_ent_t	**sh_buckets;
+	size_t		sh_nbuckets;
+	size_t		sh_nents;
+	size_t		sh_bytes;	/* entries and buckets */
+	size_t		sh_budget;
+	cache_ent_t	*sh_mru;
+	cache_ent_t	*sh_lru;
+	uint64_t	sh_hits;
+	uint64_t	sh_misses;
+	uint64_t	sh_evictions;
+} cache_shard_t;
+
+struct sysdem_cache_s {
+	sysdem_ops_t	*c_ops;
+	cache_shard_t	*c_shards;
+	size_t		c_nshards;
+};
+
+/* FNV-1a */
+static uint64_t
+cache_hash(const char *str, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return (h);
+}
+
+/*
+ * The low bits of the hash pick the bucket, so use the high bits to pick
+ * the shard.
+ */
+static cache_shard_t *
+cache_shard(sysdem_cache_t *c, uint64_t hash)
+{
+	return (&c->c_shards[(hash >> 32) & (c->c_nshards - 1)]);
+}
+
+static cache_ent_t **
+shard_bucket(cache_shard_t *sh, uint64_t hash)
+{
+	return (&sh->sh_buckets[hash & (sh->sh_nbuckets - 1)]);
+}
+
+static cache_ent_t *
+shard_find(cache_shard_t *sh, uint64_t hash, const char *str, size_t len,
+    sysdem_lang_t lang)
+{
+	cache_ent_t *ce;
+
+	if (sh->sh_nbuckets == 0)
+		return (NULL);
+
+	for (ce = *shard_bucket(sh, hash); ce != NULL; ce = ce->ce_next) {
+		if (ce->ce_hash == hash && ce->ce_keylen == len &&
+		    ce->ce_lang == lang && memcmp(ce->ce_data, str, len) == 0)
+			return (ce);
+	}
+
+	return (NULL);
+}
+
+static void
+lru_remove(cache_shard_t *sh, cache_ent_t *ce)
+{
+	if (ce->ce_lru_prev != NULL)
+		ce->ce_lru_prev->ce_lru_next = ce->ce_lru_next;
+	else
+		sh->sh_mru = ce->ce_lru_next;
+
+	if (ce->ce_lru_next != NULL)
+		ce->ce_lru_next->ce_lru_prev = ce->ce_lru_prev;
+	else
+		sh->sh_lru = ce->ce_lru_prev;
+}
+
+static void
+lru_insert(cache_shard_t *sh, cache_ent_t *ce)
+{
+	ce->ce_lru_prev = NULL;
+	ce->ce_lru_next = sh->sh_mru;
+
+	if (sh->sh_mru != NULL)
+		sh->sh_mru->ce_lru_prev = ce;
+	else
+		sh->sh_lru = ce;
+
+	sh->sh_mru = ce;
+}
+
+static void
+lru_touch(cache_shard_t *sh, cache_ent_t *ce)
+{
+	if (sh->sh_mru == ce)
+		return;
+
+	lru_remove(sh, ce);
+	lru_insert(sh, ce);
+}
+
+/*
+ * Double the number of buckets once there are as many entries as buckets.
+ * If that fails, the chains just get longer.
+ */
+static void
+shard_grow(sysdem_ops_t *ops, cache_shard_t *sh)
+{
+	cache_ent_t **buckets;
+	size_t nbuckets;
+
+	if (sh->sh_nents < sh->sh_nbuckets)
+		return;
+
+	nbuckets = (sh->sh_nbuckets == 0) ?
+	    CACHE_MIN_BUCKETS : sh->sh_nbuckets * 2;
+
+	if ((buckets = zalloc(ops, nbuckets * sizeof (cache_ent_t *))) == NULL)
+		return;
+
+	for (size_t i = 0; i < sh->sh_nbuckets; i++) {
+		cache_ent_t *ce = sh->sh_buckets[i];
+
+		while (ce != NULL) {
+			cache_ent_t *next = ce->ce_next;
+			cache_ent_t **bp = &buckets[ce->ce_hash & (nbuckets - 1)];
+
+			ce->ce_next = *bp;
+			*bp = ce;
+			ce = next;
+		}
+	}
+
+	xfree(ops, sh->sh_buckets, sh->sh_nbuckets * sizeof (cache_ent_t *));
+	sh->sh_bytes -= sh->sh_nbuckets * sizeof (cache_ent_t *);
+	sh->sh_bytes += nbuckets * sizeof (cache_ent_t *);
+	sh->sh_buckets = buckets;
+	sh->sh_nbuckets = nbuckets;
+}
+
+static void
+shard_evict(sysdem_ops_t *ops, cache_shard_t *sh, cache_ent_t *ce)
+{
+	cache_ent_t **cep = shard_bucket(sh, ce->ce_hash);
+
+	while (*cep != ce)
+		cep = &(*cep)->ce_next;
+	*cep = ce->ce_next;
+
+	lru_remove(sh, ce);
+	sh->sh_nents--;
+	sh->sh_bytes -= CE_SIZE(ce->ce_keylen, ce->ce_len);
+	xfree(ops, ce, CE_SIZE(ce->ce_keylen, ce->ce_len));
+}
+
+/*
+ * Add ce to sh, and evict the least recently used entries until the shard
+ * is back within its budget.  ce is the most recently used, so it is
+ * never evicted.
+ */
+static void
+shard_insert(sysdem_ops_t *ops, cache_shard_t *sh, cache_ent_t *ce)
+{
+	cache_ent_t **bp;
+
+	shard_grow(ops, sh);
+	if (sh->sh_nbuckets == 0) {
+		xfree(ops, ce, CE_SIZE(ce->ce_keylen, ce->ce_len));
+		return;
+	}
+
+	bp = shard_bucket(sh, ce->ce_hash);
+	ce->ce_next = *bp;
+	*bp = ce;
+	lru_insert(sh, ce);
+	sh->sh_nents++;
+	sh->sh_bytes += CE_SIZE(ce->ce_keylen, ce->ce_len);
+
+	while (sh->sh_bytes > sh->sh_budget && sh->sh_lru != ce) {
+		shard_evict(ops, sh, sh->sh_lru);
+		sh->sh_evictions++;
+	}
+}
+
+/*
+ * Copy the demangled name s out to the caller, either as a newly allocated
+ * string in *resp (if resp isn't NULL) or into buf, with the same semantics
+ * as sysdemangle_ctx() and sysdemangle_ctx_r() respectively.
+ */
+static int
+cache_copyout(sysdem_ops_t *ops, const char *s, size_t slen, char *buf,
+    size_t *lenp, char **resp)
+{
+	char *dst;
+
+	if (resp != NULL) {
+		if ((dst = xalloc(ops, slen + 1)) == NULL)
+			return (ENOMEM);
+		*resp = dst;
+	} else {
+		if (buf == NULL || *lenp <= slen) {
+			*lenp = slen + 1;
+			return (ERANGE);
+		}
+		*lenp = slen + 1;
+		dst = buf;
+	}
+
+	(void) memcpy(dst, s, slen);
+	dst[slen] = '\0';
+	return (0);
+}
+
+static int
+cache_demangle(sysdem_cache_t *c, const char *str, size_t len,
+    sysdem_lang_t lang, char *buf, size_t *lenp, char **resp)
+{
+	sysdem_ops_t *ops = c->c_ops;
+	uint64_t hash = cache_hash(str, len);
+	cache_shard_t *sh = cache_shard(c, hash);
+	cache_ent_t *ce;
+	char *name;
+	size_t namelen;
+	int ret;
+
+	(void) pthread_mutex_lock(&sh->sh_lock);
+	if ((ce = shard_find(sh, hash, str, len, lang)) != NULL) {
+		sh->sh_hits++;
+		lru_touch(sh, ce);
+		ret = cache_copyout(ops, CE_NAME(ce), ce->ce_len, buf, lenp,
+		    resp);
+		(void) pthread_mutex_unlock(&sh->sh_lock);
+		return (ret);
+	}
+	sh->sh_misses++;
+	(void) pthread_mutex_unlock(&sh->sh_lock);
+
+	if ((name = sysdemangle_n(str, len, lang, ops)) == NULL)
+		return (errno);
+	namelen = strlen(name);
+
+	/*
+	 * Entries that would take up more than the shard's whole budget are
+	 * not worth keeping.  Failing to allocate one isn't an error either;
+	 * the name just isn't cached.
+	 */
+	if (CE_SIZE(len, namelen) <= sh->sh_budget &&
+	    (ce = xalloc(ops, CE_SIZE(len, namelen))) != NULL) {
+		ce->ce_hash = hash;
+		ce->ce_lang = lang;
+		ce->ce_keylen = len;
+		ce->ce_len = namelen;
+		(void) memcpy(ce->ce_data, str, len);
+		(void) memcpy(CE_NAME(ce), name, namelen + 1);
+
+		(void) pthread_mutex_lock(&sh->sh_lock);
+		if (shard_find(sh, hash, str, len, lang) == NULL)
+			shard_insert(ops, sh, ce);
+		else
+			xfree(ops, ce, CE_SIZE(len, namelen));
+		(void) pthread_mutex_unlock(&sh->sh_lock);
+	}
+
+	if (resp != NULL) {
+		*resp = name;
+		return (0);
+	}
+
+	ret = cache_copyout(ops, name, namelen, buf, lenp, NULL);
+	xfree(ops, name, namelen + 1);
+	return (ret);
+}
+
+sysdem_cache_t *
+sysdem_cache_create(sysdem_ops_t *ops, size_t budget, size_t nshards)
+{
+	sysdem_cache_t *c;
+	size_t n;
+
+	if (ops == NULL)
+		ops = sysdem_ops_default;
+
+	if (budget == 0)
+		budget = CACHE_BUDGET;
+
+	if (nshards == 0)
+		nshards = CACHE_NSHARDS;
+
+	for (n = 1; n < nshards; n *= 2)
+		;
+
+	if ((c = zalloc(ops, sizeof (*c))) == NULL)
+		return (NULL);
+
+	if ((c->c_shards = zalloc(ops, n * sizeof (cache_shard_t))) == NULL) {
+		xfree(ops, c, sizeof (*c));
+		return (NULL);
+	}
+
+	c->c_ops = ops;
+	c->c_nshards = n;
+
+	for (size_t i = 0; i < n; i++) {
+		cache_shard_t *sh = &c->c_shards[i];
+
+		(void) pthread_mutex_init(&sh->sh_lock, NULL);
+		sh->sh_budget = budget / n;
+	}
+
+	return (c);
+}
+
+void
+sysdem_cache_destroy(sysdem_cache_t *c)
+{
+	if (c == NULL)
+		return;
+
+	sysdem_ops_t *ops = c->c_ops;
+
+	for (size_t i = 0; i < c->c_nshards; i++) {
+		cache_shard_t *sh = &c->c_shards[i];
+
+		while (sh->sh_lru != NULL)
+			shard_evict(ops, sh, sh->sh_lru);
+
+		xfree(ops, sh->sh_buckets,
+		    sh->sh_nbuckets * sizeof (cache_ent_t *));
+		(void) pthread_mutex_destroy(&sh->sh_lock);
+	}
+
+	xfree(ops, c->c_shards, c->c_nshards * sizeof (cache_shard_t));
+	xfree(ops, c, sizeof (*c));
+}
+
+char *
+sysdemangle_cache(sysdem_cache_t *c, const char *str, size_t len,
+    sysdem_lang_t lang)
+{
+	char *result = NULL;
+	int ret;
+
+	if ((ret = cache_demangle(c, str, len, lang, NULL, NULL,
+	    &result)) != 0) {
+		errno = ret;
+		return (NULL);
+	}
+
+	return (result);
+}
+
+int
+sysdemangle_cache_r(sysdem_cache_t *c, const char *str, size_t len,
+    sysdem_lang_t lang, char *buf, size_t *lenp)
+{
+	if (lenp == NULL)
+		return (EINVAL);
+
+	return (cache_demangle(c, str, len, lang, buf, lenp, NULL));
+}
+
+void
+sysdem_cache_stats(sysdem_cache_t *c, sysdem_cache_stats_t *stats)
+{
+	(void) memset(stats, 0, sizeof (*stats));
+
+	for (size_t i = 0; i < c->c_nshards; i++) {
+		cache_shard_t *sh = &c->c_shards[i];
+
+		(void) pthread_mutex_lock(&sh->sh_lock);
+		stats->cs_hits += sh->sh_hits;
+		stats->cs_misses += sh->sh_misses;
+		stats->cs_evictions += sh->sh_evictions;
+		stats->cs_entries += sh->sh_nents;
+		stats->cs_bytes += sh->sh_bytes;
+		(void) pthread_mutex_unlock(&sh->sh_lock);
+	}
+}
@@ -9,7 +9,6 @@
 
 #include <errno.h>
 #include <string.h>
-#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "sysdemangle.h"
@@ -22,7 +21,8 @@
 
 typedef struct cpp_db_s {
 	sysdem_ops_t	*cpp_ops;
-	jmp_buf		cpp_jmp;
+	sysdem_arena_t	*cpp_arena;
+	int		cpp_err;
 	name_t		cpp_name;
 	sub_t		cpp_subs;
 	templ_t		cpp_templ;
@@ -33,22 +33,48 @@ typedef struct cpp_db_s {
 	boolean_t	cpp_tag_templates;
 	boolean_t	cpp_fix_forward_references;
 	boolean_t	cpp_try_to_parse_template_args;
+	boolean_t	cpp_fwd_mark;
+	str_t		cpp_dummy;
+	sysdem_stats_t	cpp_stats;
 } cpp_db_t;
 
+/*
+ * A template parameter that refers to an argument which has not been
+ * parsed yet (a forward reference) is emitted as FWD_MARK followed by the
+ * parameter's mangled form (e.g. "\001T_").  Once the whole name has been
+ * parsed, fix_forward_refs() replaces each one with the argument it refers
+ * to.  If the mangled name itself contains FWD_MARK, the mangled form is
+ * emitted by itself and the name is parsed a second time instead.
+ */
+#define	FWD_MARK	'\001'
+
+/*
+ * Allocation failures are recorded in cpp_err instead of unwinding the
+ * parse.  Once it is set, the name/sub/template helpers below do nothing,
+ * and the main recursive parse functions (parse_encoding(), parse_type(),
+ * parse_expression(), parse_template_args()) return immediately without
+ * consuming anything, so the parse quickly fails back up to cpp_parse().
+ * Since a failed push leaves the name stack shorter than the parsing code
+ * expects, code that directly accesses the stack must tolerate that.
+ */
 #define CK(x)					\
     do {					\
-	if (!(x))				\
-		longjmp(db->cpp_jmp, 1);	\
+	if (!(x) && db->cpp_err == 0)		\
+		db->cpp_err = ENOMEM;		\
     } while (0)
 
-#define TOP_L(db) (&(name_top(&(db)->cpp_name)->strp_l))
+#define TOP_L(db) top_l(db)
+#define ARENA_OPS(db) sysdem_arena_ops((db)->cpp_arena)
 #define RLEN(f, l) ((size_t)((l) - (f)))
 #define NAMT(db, n) (nlen(db) - n)
 
 static inline boolean_t is_digit(int);
 static inline boolean_t is_upper(int);
+static inline boolean_t is_lower(int);
+static inline boolean_t is_code(const char *);
 static inline boolean_t is_xdigit(int);
 
+static str_t *top_l(cpp_db_t *);
 static boolean_t nempty(cpp_db_t *);
 static size_t nlen(cpp_db_t *);
 static void nadd_l(cpp_db_t *, const char *, size_t);
@@ -66,7 +92,11 @@ static void tpush(cpp_db_t *);
 static void tpop(cpp_db_t *);
 static void tsave(cpp_db_t *, size_t);
 
+static boolean_t fix_forward_refs(cpp_db_t *);
+static void strip_forward_refs(cpp_db_t *, str_t *);
+
 static void db_init(cpp_db_t *, sysdem_ops_t *);
+static void db_reset(cpp_db_t *);
 static void db_fini(cpp_db_t *);
 static void dump(cpp_db_t *, FILE *);
 
@@ -146,62 +176,266 @@ static const char *parse_pointer_to_member_type(const char *, const char *,
     cpp_db_t *);
 static const char *parse_vector_type(const char *, const char *, cpp_db_t *);
 
-char *
-cpp_demangle(const char *src, sysdem_ops_t *ops)
+/*
+ * Parse [first, last) into db.  On success, 0 is returned and the demangled
+ * name is left as the top (and only) entry of db->cpp_name.  Otherwise an
+ * errno value describing the failure is returned.
+ */
+static int
+cpp_parse(cpp_db_t *db, const char *first, const char *last)
 {
-	char *result = NULL;
-	cpp_db_t db;
-	size_t srclen = strlen(src);
+	db_reset(db);
+	if (db->cpp_arena == NULL)
+		return (ENOMEM);
 
-	db_init(&db, ops);
+	tpush(db);
+	if (db->cpp_err != 0)
+		return (db->cpp_err);
 
-	if (setjmp(db.cpp_jmp) != 0)
-		goto done;
+	db->cpp_fwd_mark = (memchr(first, FWD_MARK, RLEN(first, last)) == NULL);
+	db->cpp_stats.st_names++;
 
 	errno = 0;
-	demangle(src, src + srclen, &db);
-	
-	if (errno == 0 && db.cpp_fix_forward_references &&
-	    !templ_empty(&db.cpp_templ) &&
-	    !sub_empty(&db.cpp_templ.tpl_items[0])) {
-		db.cpp_fix_forward_references = B_FALSE;
-		db.cpp_tag_templates = B_FALSE;
-		name_clear(&db.cpp_name);
-		sub_clear(&db.cpp_subs);
-
-		if (setjmp(db.cpp_jmp) != 0)
-			goto done;
-
-		demangle(src, src + srclen, &db);
-
-		if (db.cpp_fix_forward_references) {
-			errno = EINVAL;
-			goto done;
+	demangle(first, last, db);
+
+	if (db->cpp_err == 0 && errno == 0 && db->cpp_fix_forward_references &&
+	    !templ_empty(&db->cpp_templ) &&
+	    templ_frame_len(&db->cpp_templ, 0) > 0) {
+		db->cpp_stats.st_fwd_refs++;
+
+		if (!fix_forward_refs(db)) {
+			db->cpp_stats.st_reparsed++;
+			db->cpp_fix_forward_references = B_FALSE;
+			db->cpp_tag_templates = B_FALSE;
+			name_clear(&db->cpp_name);
+			sub_clear(&db->cpp_subs);
+
+			demangle(first, last, db);
+
+			if (db->cpp_err == 0 && db->cpp_fix_forward_references)
+				return (EINVAL);
+
+			/*
+			 * Any markers left were copied from the template
+			 * arguments, where they were never resolved.
+			 */
+			db->cpp_fix_forward_references = B_TRUE;
 		}
 	}
 
+	if (db->cpp_err != 0)
+		return (db->cpp_err);
+
 	if (errno != 0)
-		goto done;
+		return (errno);
 
-	njoin(&db, 0, "");
+	njoin(db, 0, "");
 
-	if (nlen(&db) > 0) {
-		str_t *s = TOP_L(&db);
-		result = zalloc(ops, s->str_len + 1);
-		if (result == NULL)
-			goto done;
+	if (db->cpp_fix_forward_references && db->cpp_fwd_mark && !nempty(db))
+		strip_forward_refs(db, TOP_L(db));
 
-		(void) memcpy(result, s->str_s, s->str_len);
+	if (db->cpp_err != 0)
+		return (db->cpp_err);
+
+	if (nempty(db))
+		return (EINVAL);
+
+	return (0);
+}
+
+/*
+ * Demangle using an existing db (see cpp_db_create()).  The db is reset
+ * before parsing, but any memory it has accumulated from previous calls is
+ * reused.  On success, *resp and *lenp are set to the demangled name (which
+ * is not NUL-terminated) and its length.  The name is stored in the db and
+ * is only valid until the db is next used.
+ */
+int
+cpp_demangle_db_str(cpp_db_t *db, const char *src, size_t srclen,
+    const char **resp, size_t *lenp)
+{
+	int ret;
+
+	ret = cpp_parse(db, src, src + srclen);
+	if (ret == 0) {
+		str_t *s = TOP_L(db);
+
+		*resp = STR_DATA(s);
+		*lenp = s->str_len;
 	}
 
-done:
 	if (getenv("DEMANGLE_DEBUG") != NULL)
-		dump(&db, stdout);
+		dump(db, stdout);
+
+	return (ret);
+}
+
+/* Like cpp_demangle_db_str(), but return a copy allocated with db's ops */
+char *
+cpp_demangle_db(cpp_db_t *db, const char *src, size_t srclen)
+{
+	char *result = NULL;
+	const char *s = NULL;
+	size_t len = 0;
+	int ret;
+
+	ret = cpp_demangle_db_str(db, src, srclen, &s, &len);
+	if (ret == 0) {
+		result = xalloc(result_ops(db->cpp_ops), len + 1);
+		if (result != NULL) {
+			(void) memcpy(result, s, len);
+			result[len] = '\0';
+		} else {
+			ret = ENOMEM;
+		}
+	}
+
+	errno = ret;
+	return (result);
+}
 
+/*
+ * Like cpp_demangle_db(), but write the result into buf (of *lenp bytes)
+ * instead of allocating it.  *lenp is always updated with the size needed
+ * to hold the demangled name (including the terminating NUL) when parsing
+ * succeeds; ERANGE is returned if buf is too small.
+ */
+int
+cpp_demangle_db_r(cpp_db_t *db, const char *src, size_t srclen, char *buf,
+    size_t *lenp)
+{
+	const char *s = NULL;
+	size_t len = 0;
+	int ret;
+
+	ret = cpp_demangle_db_str(db, src, srclen, &s, &len);
+	if (ret == 0) {
+		if (buf != NULL && *lenp > len) {
+			(void) memcpy(buf, s, len);
+			buf[len] = '\0';
+		} else {
+			ret = ERANGE;
+		}
+
+		*lenp = len + 1;
+	}
+
+	return (ret);
+}
+
+char *
+cpp_demangle(const char *src, size_t srclen, sysdem_ops_t *ops)
+{
+	char *result = NULL;
+	cpp_db_t db;
+	int ret;
+
+	db_init(&db, ops);
+	result = cpp_demangle_db(&db, src, srclen);
+	ret = errno;
 	db_fini(&db);
+	errno = ret;
 	return (result);
 }
 
+int
+cpp_demangle_r(const char *src, size_t srclen, char *buf, size_t *lenp,
+    sysdem_ops_t *ops)
+{
+	cpp_db_t db;
+	int ret;
+
+	db_init(&db, ops);
+	ret = cpp_demangle_db_r(&db, src, srclen, buf, lenp);
+	db_fini(&db);
+	return (ret);
+}
+
+cpp_db_t *
+cpp_db_create(sysdem_ops_t *ops)
+{
+	cpp_db_t *db = zalloc(ops, sizeof (*db));
+
+	if (db == NULL)
+		return (NULL);
+
+	db_init(db, ops);
+	return (db);
+}
+
+void
+cpp_db_stats(const cpp_db_t *db, sysdem_stats_t *stats)
+{
+	*stats = db->cpp_stats;
+}
+
+void
+cpp_db_destroy(cpp_db_t *db)
+{
+	if (db == NULL)
+		return;
+
+	sysdem_ops_t *ops = db->cpp_ops;
+
+	db_fini(db);
+	xfree(ops, db, sizeof (*db));
+}
+
+/*
+ * A quick check of whether [first, last) could be something demangle()
+ * accepts, made without touching a db.  Only the prefix and the first
+ * character of the <encoding> are looked at, so B_TRUE doesn't mean the name
+ * is well formed, but for B_FALSE demangle() is certain to fail.  Anything
+ * not starting with '_' is taken to be a bare <type> and is left to the
+ * parser.
+ */
+boolean_t
+cpp_is_mangled(const char *first, const char *last)
+{
+	if (first >= last)
+		return (B_FALSE);
+
+	if (first[0] != '_')
+		return (B_TRUE);
+
+	if (last - first < 4)
+		return (B_FALSE);
+
+	if (first[1] == 'Z')
+		first += 2;
+	else if (first[1] == '_' && first[2] == '_' && first[3] == 'Z')
+		first += 4;
+	else
+		return (B_FALSE);
+
+	if (first == last)
+		return (B_FALSE);
+
+	/* <encoding> is a <special-name> or starts with a <name> */
+	if (first[0] == 'G' || first[0] == 'T')
+		return (B_TRUE);
+
+	/* extension: parse_name() ignores an L here */
+	if (first[0] == 'L' && ++first == last)
+		return (B_FALSE);
+
+	switch (first[0]) {
+	case 'C':
+	case 'D':
+	case 'N':
+	case 'S':
+	case 'U':
+	case 'Z':
+		return (B_TRUE);
+	}
+
+	/* a <source-name> or an <operator-name> */
+	if (is_digit(first[0]))
+		return ((first[0] != '0') ? B_TRUE : B_FALSE);
+
+	return (is_lower(first[0]));
+}
+
 static void
 demangle(const char *first, const char *last, cpp_db_t *db)
 {
@@ -282,7 +516,7 @@ parse_block_invoke(const char *first, const char *last, cpp_db_t *db)
 	if (strncmp(first, test, sizeof (test) - 1) != 0)
 		return (first);
 
-	t += sizeof (test);
+	t += sizeof (test) - 1;
 	if (t == last)
 		goto done;
 
@@ -312,7 +546,7 @@ done:
 static const char *
 parse_encoding(const char *first, const char *last, cpp_db_t *db)
 {
-	if (first == last)
+	if (first == last || db->cpp_err != 0)
 		return (first);
 
 	const char *t = NULL;
@@ -352,7 +586,7 @@ parse_encoding(const char *first, const char *last, cpp_db_t *db)
 		str_pair_t *sp = name_top(&db->cpp_name);
 
 		if (str_length(&sp->strp_r) == 0)
-			str_append(&sp->strp_l, " ", 1);
+			CK(str_append(&sp->strp_l, " ", 1));
 
 		nfmt(db, "{0:L}{1:L}", "{1:R}{0:R}");
 		t = t2;
@@ -373,7 +607,8 @@ parse_encoding(const char *first, const char *last, cpp_db_t *db)
 			if (t2 == t || t == last)
 				break;
 
-			if (str_pair_len(name_top(&db->cpp_name)) == 0)
+			if (!nempty(db) &&
+			    str_pair_len(name_top(&db->cpp_name)) == 0)
 				(void) name_pop(&db->cpp_name, NULL);
 
 			t = t2;
@@ -480,7 +715,7 @@ parse_special_name(const char *first, const char *last, cpp_db_t *db)
 			if (t == first + 2)
 				return (first);
 			t1 = parse_number(t, last);
-			if (*t1 != '_')
+			if (t1 == last || *t1 != '_')
 				return (first);
 			t = parse_type(t1 + 1, last, db);
 			if (t == t1 + 1 || nlen(db) < 2)
@@ -620,7 +855,7 @@ parse_name(const char *first, const char *last,
 	t1 = parse_unscoped_name(t, last, db);
 
 	/* <unscoped-name> */
-	if (t != t1 && t1[0] != 'I')
+	if (t != t1 && (t1 == last || t1[0] != 'I'))
 		return (t1);
 
 	if (t == t1) {
@@ -670,6 +905,9 @@ parse_local_name(const char *first, const char *last,
 	/* skip E */
 	t++;
 
+	if (t == last)
+		return (first);
+
 	if (t[0] == 's') {
 		nfmt(db, "{0:L}::string literal", "{0:R}");
 		return (parse_discriminator(t, last));
@@ -677,7 +915,7 @@ parse_local_name(const char *first, const char *last,
 
 	if (t[0] == 'd') {
 		t1 = parse_number(t + 1, last);
-		if (t1[0] != '_')
+		if (t1 == last || t1[0] != '_')
 			return (first);
 		t1++;
 	} else {
@@ -741,9 +979,9 @@ parse_nested_name(const char *first, const char *last,
 		t++;
 		break;
 	case 'S':
-		if (last - first < 2 || t[1] != 't')
+		if (last - t < 2 || t[1] != 't')
 			break;
-		if (last - first == 2)
+		if (last - t == 2)
 			return (first);
 		nadd_l(db, "std", 3);
 		more = B_TRUE;
@@ -754,7 +992,7 @@ parse_nested_name(const char *first, const char *last,
 	boolean_t pop_subs = B_FALSE;
 	boolean_t component_ends_with_template_args = B_FALSE;
 
-	while (t[0] != 'E' && t != last) {
+	while (t != last && t[0] != 'E') {
 		const char *t1 = NULL;
 		component_ends_with_template_args = B_FALSE;
 
@@ -849,9 +1087,9 @@ parse_nested_name(const char *first, const char *last,
 		t = t1;
 	}
 
+	if (t == last)
+		return (first);
 
-
-done:
 	db->cpp_cv = cv;
 	if (pop_subs && !sub_empty(&db->cpp_subs))
 		sub_pop(&db->cpp_subs);
@@ -881,7 +1119,7 @@ parse_template_arg(const char *first, const char *last, cpp_db_t *db)
 	switch (first[0]) {
 	case 'X':
 		t = parse_expression(first + 1, last, db);
-		if (t == first + 1 || t[0] != 'E')
+		if (t == first + 1 || t == last || t[0] != 'E')
 			return (first);
 
 		/* E */
@@ -893,13 +1131,16 @@ parse_template_arg(const char *first, const char *last, cpp_db_t *db)
 		if (t == last)
 			return (first);
 
-		while (t[0] != 'E') {
+		while (t != last && t[0] != 'E') {
 			t1 = parse_template_arg(t, last, db);
 			if (t == t1)
 				return (first);
 			t = t1;
 		}
 
+		if (t == last)
+			return (first);
+
 		/* E */
 		t++;
 		break;
@@ -968,21 +1209,28 @@ parse_template_arg(const char *first, const char *last, cpp_db_t *db)
  *END CSTYLED
  */
 
-#define PA(cd, arg, fn) {	\
-	.code = cd,		\
-	.p.parse_expr_arg = fn,	\
-	.fntype = EXPR_ARG,	\
-	.val = arg		\
+/*
+ * The two character expression and operator codes are always a lower case
+ * letter followed by a letter, so expr_tbl and op_tbl are indexed directly
+ * by the two characters (see is_code()) instead of being searched.
+ */
+#define	CODE_ROWS	26
+#define	CODE_COLS	52
+#define	CODE_ROW(c)	((c) - 'a')
+#define	CODE_COL(c)	(((c) >= 'a') ? (c) - 'a' + 26 : (c) - 'A')
+
+#define PA(c0, c1, arg, fn) [CODE_ROW(c0)][CODE_COL(c1)] = {	\
+	.p.parse_expr_arg = fn,					\
+	.fntype = EXPR_ARG,					\
+	.val = arg						\
 }
 
-#define PN(cd, fn) {			\
-	.code = cd,			\
-	.p.parse_expr_noarg = fn,	\
-	.fntype = EXPR_NOARG		\
+#define PN(c0, c1, fn) [CODE_ROW(c0)][CODE_COL(c1)] = {	\
+	.p.parse_expr_noarg = fn,				\
+	.fntype = EXPR_NOARG					\
 }
 
-static struct {
-	const char code[3];
+static const struct expr_s {
 	union {
 		const char *(*parse_expr_arg)(const char *, const char *,
 		    const char *, cpp_db_t *);
@@ -990,79 +1238,80 @@ static struct {
 		    cpp_db_t *);
 	} p;
 	enum {
+		EXPR_NONE,
 		EXPR_ARG,
 		EXPR_NOARG
 	} fntype;
 	const char val[4];
-} expr_tbl[] = {
-	PA("aN", "&=", parse_binary_expr),
-	PA("aS", "=", parse_binary_expr),
-	PA("aa", "&&", parse_binary_expr),
-	PA("ad", "&", parse_prefix_expr),
-	PA("an", "&", parse_binary_expr),
-	PN("at", parse_alignof),
-	PN("az", parse_alignof),
-	PN("cc", parse_cast_expr),
-	PN("cl", parse_call_expr),
-	PA("cm", ",", parse_binary_expr),
-	PA("co", "~", parse_prefix_expr),
-	PN("cv", parse_conv_expr),
-	PN("da", parse_del_expr),
-	PA("dV", "/=", parse_binary_expr),
-	PN("dc", parse_cast_expr),
-	PA("de", "*", parse_prefix_expr),
-	PN("dl", parse_del_expr),
-	PN("dn", parse_unresolved_name),
-	PN("ds", parse_dot_star_expr),
-	PN("dt", parse_dot_expr),
-	PA("dv", "/", parse_binary_expr),
-	PA("eO", "^=", parse_binary_expr),
-	PA("eo", "^", parse_binary_expr),
-	PA("eq", "==", parse_binary_expr),
-	PA("ge", ">=", parse_binary_expr),
-	PN("gs", parse_gs),
-	PA("gt", ">", parse_binary_expr),
-	PN("ix", parse_idx_expr),
-	PA("lS", "<<=", parse_binary_expr),
-	PA("le", "<=", parse_binary_expr),
-	PA("ls", "<<", parse_binary_expr),
-	PA("lt", "<", parse_binary_expr),
-	PA("mI", "-=", parse_binary_expr),
-	PA("mL", "*=", parse_binary_expr),
-	PN("mm", parse_mm_expr),
-	PA("mi", "-", parse_binary_expr),
-	PA("ml", "*", parse_binary_expr),
-	PN("na", parse_new_expr),
-	PA("ne", "!=", parse_binary_expr),
-	PA("ng", "-", parse_prefix_expr),
-	PA("nt", "!", parse_prefix_expr),
-	PN("nw", parse_new_expr),
-	PN("nx", parse_noexcept_expr),
-	PA("oR", "|=", parse_binary_expr),
-	PN("on", parse_unresolved_name),
-	PA("oo", "||", parse_binary_expr),
-	PA("or", "|", parse_binary_expr),
-	PA("pL", "+=", parse_binary_expr),
-	PA("pl", "+", parse_binary_expr),
-	PA("pm", "->*", parse_binary_expr),
-	PN("pp", parse_pp_expr),
-	PA("ps", "+", parse_prefix_expr),
-	PN("pt", parse_arrow_expr),
-	PN("qu", parse_trinary_expr),
-	PA("rM", "%=", parse_binary_expr),
-	PA("rS", ">>=", parse_binary_expr),
-	PN("rc", parse_cast_expr),
-	PA("rm", "%", parse_binary_expr),
-	PA("rs", ">>", parse_binary_expr),
-	PN("sc", parse_cast_expr),
-	PN("sp", parse_pack_expansion),
-	PN("sr", parse_unresolved_name),
-	PN("st", parse_sizeof),
-	PN("sz", parse_sizeof),
-	PN("sZ", parse_sizeof_param_pack_expr),
-	PN("te", parse_typeid_expr),
-	PN("tr", parse_throw_expr),
-	PN("tw", parse_throw_expr)
+} expr_tbl[CODE_ROWS][CODE_COLS] = {
+	PA('a', 'N', "&=", parse_binary_expr),
+	PA('a', 'S', "=", parse_binary_expr),
+	PA('a', 'a', "&&", parse_binary_expr),
+	PA('a', 'd', "&", parse_prefix_expr),
+	PA('a', 'n', "&", parse_binary_expr),
+	PN('a', 't', parse_alignof),
+	PN('a', 'z', parse_alignof),
+	PN('c', 'c', parse_cast_expr),
+	PN('c', 'l', parse_call_expr),
+	PA('c', 'm', ",", parse_binary_expr),
+	PA('c', 'o', "~", parse_prefix_expr),
+	PN('c', 'v', parse_conv_expr),
+	PN('d', 'a', parse_del_expr),
+	PA('d', 'V', "/=", parse_binary_expr),
+	PN('d', 'c', parse_cast_expr),
+	PA('d', 'e', "*", parse_prefix_expr),
+	PN('d', 'l', parse_del_expr),
+	PN('d', 'n', parse_unresolved_name),
+	PN('d', 's', parse_dot_star_expr),
+	PN('d', 't', parse_dot_expr),
+	PA('d', 'v', "/", parse_binary_expr),
+	PA('e', 'O', "^=", parse_binary_expr),
+	PA('e', 'o', "^", parse_binary_expr),
+	PA('e', 'q', "==", parse_binary_expr),
+	PA('g', 'e', ">=", parse_binary_expr),
+	PN('g', 's', parse_gs),
+	PA('g', 't', ">", parse_binary_expr),
+	PN('i', 'x', parse_idx_expr),
+	PA('l', 'S', "<<=", parse_binary_expr),
+	PA('l', 'e', "<=", parse_binary_expr),
+	PA('l', 's', "<<", parse_binary_expr),
+	PA('l', 't', "<", parse_binary_expr),
+	PA('m', 'I', "-=", parse_binary_expr),
+	PA('m', 'L', "*=", parse_binary_expr),
+	PN('m', 'm', parse_mm_expr),
+	PA('m', 'i', "-", parse_binary_expr),
+	PA('m', 'l', "*", parse_binary_expr),
+	PN('n', 'a', parse_new_expr),
+	PA('n', 'e', "!=", parse_binary_expr),
+	PA('n', 'g', "-", parse_prefix_expr),
+	PA('n', 't', "!", parse_prefix_expr),
+	PN('n', 'w', parse_new_expr),
+	PN('n', 'x', parse_noexcept_expr),
+	PA('o', 'R', "|=", parse_binary_expr),
+	PN('o', 'n', parse_unresolved_name),
+	PA('o', 'o', "||", parse_binary_expr),
+	PA('o', 'r', "|", parse_binary_expr),
+	PA('p', 'L', "+=", parse_binary_expr),
+	PA('p', 'l', "+", parse_binary_expr),
+	PA('p', 'm', "->*", parse_binary_expr),
+	PN('p', 'p', parse_pp_expr),
+	PA('p', 's', "+", parse_prefix_expr),
+	PN('p', 't', parse_arrow_expr),
+	PN('q', 'u', parse_trinary_expr),
+	PA('r', 'M', "%=", parse_binary_expr),
+	PA('r', 'S', ">>=", parse_binary_expr),
+	PN('r', 'c', parse_cast_expr),
+	PA('r', 'm', "%", parse_binary_expr),
+	PA('r', 's', ">>", parse_binary_expr),
+	PN('s', 'c', parse_cast_expr),
+	PN('s', 'p', parse_pack_expansion),
+	PN('s', 'r', parse_unresolved_name),
+	PN('s', 't', parse_sizeof),
+	PN('s', 'z', parse_sizeof),
+	PN('s', 'Z', parse_sizeof_param_pack_expr),
+	PN('t', 'e', parse_typeid_expr),
+	PN('t', 'r', parse_throw_expr),
+	PN('t', 'w', parse_throw_expr)
 };
 #undef PA
 #undef PN
@@ -1070,17 +1319,20 @@ static struct {
 static const char *
 parse_expression(const char *first, const char *last, cpp_db_t *db)
 {
-	if (last - first < 2)
+	if (last - first < 2 || db->cpp_err != 0)
 		return (first);
 
-	for (size_t i = 0; i < ARRAY_SIZE(expr_tbl); i++) {
-		if (strncmp(expr_tbl[i].code, first, 2) != 0)
-			continue;
-		switch (expr_tbl[i].fntype) {
+	if (is_code(first)) {
+		const struct expr_s *e =
+		    &expr_tbl[CODE_ROW(first[0])][CODE_COL(first[1])];
+
+		switch (e->fntype) {
 		case EXPR_ARG:
-			return (expr_tbl[i].p.parse_expr_arg(first, last, expr_tbl[i].val, db));
+			return (e->p.parse_expr_arg(first, last, e->val, db));
 		case EXPR_NOARG:
-			return (expr_tbl[i].p.parse_expr_noarg(first, last, db));
+			return (e->p.parse_expr_noarg(first, last, db));
+		case EXPR_NONE:
+			break;
 		}
 	}
 
@@ -1209,7 +1461,7 @@ parse_new_expr(const char *first, const char *last, cpp_db_t *db)
 	}
 
 	t2 = parse_type(t1 + 1, last, db);
-	if (t1 + 1 == t2)
+	if (t1 + 1 == t2 || t2 == last)
 		return (first);
 
 	if (t2[0] != 'E') {
@@ -1222,7 +1474,7 @@ parse_new_expr(const char *first, const char *last, cpp_db_t *db)
 		const char *t3 = t2;
 		size_t n1 = nlen(db);
 
-		while (t2[0] != 'E' && t2 != last) {
+		while (t2 != last && t2[0] != 'E') {
 			t3 = parse_expression(t2, last, db);
 
 			if (t2 == t3)
@@ -1421,18 +1673,18 @@ parse_arrow_expr(const char *first, const char *last, cpp_db_t *db)
 
 /* wrap value in () when necessary */
 static void
-paren(str_pair_t *sp)
+paren(str_pair_t *sp, cpp_db_t *db)
 {
 	str_t *l = &sp->strp_l;
 	str_t *r = &sp->strp_r;
 
 	if (str_length(r) > 1 &&
-	    r->str_s[0] == ' ' && r->str_s[1] == '[') {
-		str_append(l, " (", 2);
-		str_insert(r, 0, ")", 1);
-	} else if (str_length(r) > 0 && r->str_s[0] == '('){
-		str_append(l, "(", 1);
-		str_insert(r, 0, ")", 1);
+	    STR_DATA(r)[0] == ' ' && STR_DATA(r)[1] == '[') {
+		CK(str_append(l, " (", 2));
+		CK(str_insert(r, 0, ")", 1));
+	} else if (str_length(r) > 0 && STR_DATA(r)[0] == '('){
+		CK(str_append(l, "(", 1));
+		CK(str_insert(r, 0, ")", 1));
 	}
 }
 
@@ -1465,7 +1717,7 @@ paren(str_pair_t *sp)
 static const char *
 parse_type(const char *first, const char *last, cpp_db_t *db)
 {
-	if (first == last)
+	if (first == last || db->cpp_err != 0)
 		return (first);
 
 	switch (first[0]) {
@@ -1481,6 +1733,11 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 	size_t n = nlen(db);
 	size_t amt = 0;
 
+	/*
+	 * must check for builtin-types before class-enum-types to avoid
+	 * ambiguities with operator-names.  None of the builtin codes start
+	 * any of the other productions below, so this is done once, up front.
+	 */
 	t = parse_builtin_type(first, last, db);
 	if (t != first)
 		return (t);
@@ -1498,7 +1755,7 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 		if (t == first + 1 || NAMT(db, n) == 0)
 			return (first);
 
-		str_append(TOP_L(db), " complex", 8);
+		CK(str_append(TOP_L(db), " complex", 8));
 		save_top(db, 1);
 		return (t);
 
@@ -1514,7 +1771,7 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 		if (t == first + 1 || NAMT(db, n) == 0)
 			return (first);
 
-		str_append(TOP_L(db), " imaginary", 10);
+		CK(str_append(TOP_L(db), " imaginary", 10));
 		save_top(db, 1);
 		return (t);
 
@@ -1527,15 +1784,15 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 
 	case 'O':
 		t = parse_type(first + 1, last, db);
-		amt = NAMT(db, n);
-		if (t == first + 1 || amt == 0)
+		if (t == first + 1 || nlen(db) <= n)
 			return (first);
 
+		amt = NAMT(db, n);
 		sp = name_at(&db->cpp_name, amt - 1);
 		for (size_t i = 0; i < amt; i++, sp++) {
-			paren(sp);
+			paren(sp, db);
 			if (str_pair_len(sp) > 0)
-				str_append(&sp->strp_l, "&&", 2);
+				CK(str_append(&sp->strp_l, "&&", 2));
 		}
 
 		save_top(db, amt);
@@ -1543,7 +1800,7 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 
 	case 'P':
 		t = parse_type(first + 1, last, db);
-		if (t == first + 1)
+		if (t == first + 1 || nlen(db) <= n)
 			return (first);
 
 		amt = NAMT(db, n);
@@ -1554,13 +1811,13 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 			if (str_pair_len(sp) == 0)
 				continue;
 
-			paren(sp);
-			if (first[1] != 'U' ||
-			    strncmp(l->str_s, "objc_object<", 12) != 0) {
-				str_append(l, "*", 1);
+			paren(sp, db);
+			if (first[1] != 'U' || str_length(l) < 12 ||
+			    strncmp(STR_DATA(l), "objc_object<", 12) != 0) {
+				CK(str_append(l, "*", 1));
 			} else {
-				str_erase(l, 0, 11);
-				str_insert(l, 0, "id", 2);
+				CK(str_erase(l, 0, 11));
+				CK(str_insert(l, 0, "id", 2));
 			}
 		}
 		save_top(db, amt);
@@ -1568,7 +1825,7 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 
 	case 'R':
 		t = parse_type(first + 1, last, db);
-		if (t == first + 1)
+		if (t == first + 1 || nlen(db) <= n)
 			return (first);
 
 		amt = NAMT(db, n);
@@ -1578,8 +1835,8 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 			    str_length(&sp->strp_r) == 0)
 				continue;
 
-			paren(sp);
-			str_append(&sp->strp_l, "&", 1);
+			paren(sp, db);
+			CK(str_append(&sp->strp_l, "&", 1));
 		}
 
 		save_top(db, amt);
@@ -1612,18 +1869,42 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 			return (first);
 
 		nfmt(db, "{0}", NULL);
-		const str_t *name = TOP_L(db);
 
 		t1 = parse_type(t, last, db);
 		if (t1 == t || NAMT(db, n) < 2)
 			return (first);
 
-		if (strncmp(name->str_s, "objcproto", 9) != 0) {
+		/*
+		 * parse_type() (and parse_source_name() below) may have
+		 * moved the name stack, so find the name again.
+		 */
+		const str_t *name = &name_at(&db->cpp_name, 1)->strp_l;
+
+		if (str_length(name) < 9 ||
+		    strncmp(STR_DATA(name), "objcproto", 9) != 0) {
 			nfmt(db, "{0} {1}", NULL);
 		} else {
-			t = parse_source_name(name->str_s + 9,
-			    name->str_s + name->str_len, db);
-			if (t != name->str_s + 9) {
+			const char *pstart = STR_DATA(name) + 9;
+			size_t plen = name->str_len - 9;
+
+			/*
+			 * The source name refers to the text it was parsed
+			 * from, which can't be an inline string since those
+			 * move with the name stack.
+			 */
+			if (name->str_s == NULL) {
+				char *copy = xalloc(ARENA_OPS(db), plen);
+
+				if (copy == NULL) {
+					db->cpp_err = ENOMEM;
+					return (first);
+				}
+				(void) memcpy(copy, pstart, plen);
+				pstart = copy;
+			}
+
+			t = parse_source_name(pstart, pstart + plen, db);
+			if (t != pstart) {
 				nfmt(db, "{1}<{0}>", NULL);
 
 				str_pair_t save = {0};
@@ -1707,14 +1988,6 @@ parse_type(const char *first, const char *last, cpp_db_t *db)
 		break;
 	}
 
-	/*
-	 * must check for builtin-types before class-enum-types to avoid
-	 * ambiguities with operator-names
-	 */
-	t = parse_builtin_type(first, last, db);
-	if (t != first)
-		return (t);
-
 	t = parse_name(first, last, NULL, db);
 	if (t == first || NAMT(db, n) == 0)
 		return (first);
@@ -1731,17 +2004,17 @@ parse_qual_type(const char *first, const char *last, cpp_db_t *db)
 	unsigned cv = 0;
 
 	t = parse_cv_qualifiers(first, last, &cv);
-	if (t == first)
+	if (t == first || t == last)
 		return (first);
 
 	size_t n = nlen(db);
 	boolean_t is_func = !!(t[0] == 'F');
 
 	t1 = parse_type(t, last, db);
-	size_t amt = NAMT(db, n);
-	if (t == t1 || amt == 0)
+	if (t == t1 || nlen(db) <= n)
 		return (first);
 
+	size_t amt = NAMT(db, n);
 	if (is_func)
 		sub_pop(&db->cpp_subs);
 
@@ -1757,11 +2030,11 @@ parse_qual_type(const char *first, const char *last, cpp_db_t *db)
 				continue;
 
 			if (cv & 1)
-				str_append(s, " const", 6);
+				CK(str_append(s, " const", 6));
 			if (cv & 2)
-				str_append(s, " volatile", 9);
+				CK(str_append(s, " volatile", 9));
 			if (cv & 4)
-				str_append(s, " restrict", 9);
+				CK(str_append(s, " restrict", 9));
 
 			continue;
 		}
@@ -1769,22 +2042,22 @@ parse_qual_type(const char *first, const char *last, cpp_db_t *db)
 		s = &sp->strp_r;
 		size_t pos = str_length(s);
 
-		if (s->str_s[pos - 1] == '&') {
+		if (pos > 0 && STR_DATA(s)[pos - 1] == '&') {
 			pos--;
-			if (s->str_s[pos - 1] == '&')
+			if (pos > 0 && STR_DATA(s)[pos - 1] == '&')
 				pos--;
 		}
 
 		if (cv & 1) {
-			str_insert(s, pos, " const", 6);
+			CK(str_insert(s, pos, " const", 6));
 			pos += 6;
 		}
 		if (cv & 2) {
-			str_insert(s, pos, " volatile", 9);
+			CK(str_insert(s, pos, " volatile", 9));
 			pos += 9;
 		}
 		if (cv & 4) {
-			str_insert(s, pos, " restrict", 9);
+			CK(str_insert(s, pos, " restrict", 9));
 		}
 	}
 
@@ -2078,7 +2351,7 @@ parse_conv_expr(const char *first, const char *last, cpp_db_t *db)
 	t = parse_type(first + 2, last, db);
 	db->cpp_try_to_parse_template_args = try_to_parse_template_args;
 
-	if (t == first + 2)
+	if (t == first + 2 || t == last)
 		return (first);
 
 	if (t[0] != '_') {
@@ -2092,13 +2365,16 @@ parse_conv_expr(const char *first, const char *last, cpp_db_t *db)
 
 		/* skip _ */
 		t++;
-		while (t[0] != 'E' && t != last) {
+		while (t != last && t[0] != 'E') {
 			t1 = parse_expression(t, last, db);
 			if (t1 == t)
 				return (first);
-			t1 = t;
+			t = t1;
 		}
 
+		if (t == last)
+			return (first);
+
 		/* E */
 		t++;
 
@@ -2220,7 +2496,7 @@ parse_unscoped_name(const char *first, const char *last, cpp_db_t *db)
 		st = B_TRUE;
 		t = first + 2;
 
-		if (first + 3 != last && first[2] == 'L')
+		if (last - first > 3 && first[2] == 'L')
 			t++;
 	}
 
@@ -2293,7 +2569,7 @@ parse_unnamed_type_name(const char *first, const char *last, cpp_db_t *db)
 		while (t1 != last && t1[0] != '_' && is_digit(t1[0]))
 			t1++;
 
-		if (t1[0] != '_')
+		if (t1 == last || t1[0] != '_')
 			return (first);
 
 		if (t1 == first + 2)
@@ -2305,6 +2581,9 @@ parse_unnamed_type_name(const char *first, const char *last, cpp_db_t *db)
 		return (t1 + 1);
 	}
 
+	if (t1 == last)
+		return (first);
+
 	if (first[2] != 'v') {
 		size_t n = nlen(db);
 
@@ -2330,7 +2609,7 @@ parse_unnamed_type_name(const char *first, const char *last, cpp_db_t *db)
 		t1++;
 	} else {
 		t1++;
-		if (t1[0] != 'E')
+		if (t1 == last || t1[0] != 'E')
 			return (first);
 
 		nadd_l(db, "", 0);
@@ -2345,7 +2624,7 @@ parse_unnamed_type_name(const char *first, const char *last, cpp_db_t *db)
 			return (first);
 	}
 
-	if (t2[0] != '_') {
+	if (t2 == last || t2[0] != '_') {
 		(void) name_pop(&db->cpp_name, NULL);
 		return (first);
 	}
@@ -2397,7 +2676,7 @@ basename(cpp_db_t *db)
 	for (size_t i = 0; i < ARRAY_SIZE(aliases); i++) {
 		if (str_length(s) != strlen(aliases[i].alias))
 			continue;
-		if (strncmp(aliases[i].alias, s->str_s, str_length(s)) != 0)
+		if (strncmp(aliases[i].alias, STR_DATA(s), str_length(s)) != 0)
 			continue;
 
 		/* swap out alias for full name */
@@ -2410,8 +2689,8 @@ basename(cpp_db_t *db)
 		return;
 	}
 
-	const char *start = s->str_s;
-	const char *end = s->str_s + s->str_len;
+	const char *start = STR_DATA(s);
+	const char *end = start + s->str_len;
 
 	/*
 	 * if name ends with a template i.e. <.....> back up to start
@@ -2419,7 +2698,7 @@ basename(cpp_db_t *db)
 	 */
 	unsigned c = 0;
 
-	if (end[-1] == '>') {
+	if (end > start && end[-1] == '>') {
 		for (; end > start; end--) {
 			switch (end[-1]) {
 			case '<':
@@ -2439,14 +2718,24 @@ out:
 	if (end - start < 2)
 		return;
 
-	for (start = end; start > s->str_s; start--) {
+	for (start = end - 1; start > STR_DATA(s); start--) {
 		if (start[0] == ':') {
 			start++;
 			break;
 		}
 	}
 
-	nadd_l(db, start, (size_t)(end - start));
+	if (s->str_s != NULL) {
+		nadd_l(db, start, (size_t)(end - start));
+		return;
+	}
+
+	/* an inline s moves with the name stack, so copy the base name */
+	str_t base;
+
+	str_init(&base, ARENA_OPS(db));
+	str_set(&base, start, (size_t)(end - start));
+	CK(str_reserve(&base, 0) && name_add_str(&db->cpp_name, &base, NULL));
 }
 
 /*
@@ -2485,7 +2774,7 @@ parse_ctor_dtor_name(const char *first, const char *last, cpp_db_t *db)
 		case '2':
 		case '5':
 			basename(db);
-			str_insert(TOP_L(db), 0, "~", 1);
+			CK(str_insert(TOP_L(db), 0, "~", 1));
 			break;
 		default:
 			return (first);
@@ -2546,7 +2835,8 @@ parse_floating_literal(const char *first, const char *last, cpp_db_t *db)
 		break;
 	}
 
-	if (fd == NULL || (size_t)(last - first) < fd->mangled_size)
+	/* type, mangled_size hex digits, and the trailing 'E' */
+	if (fd == NULL || (size_t)(last - first) < fd->mangled_size + 2)
 		return (first);
 
 	union {
@@ -2611,11 +2901,14 @@ parse_floating_literal(const char *first, const char *last, cpp_db_t *db)
 		return (first);
 
 	str_t num = { 0 };
-	str_init(&num, db->cpp_ops);
+	str_init(&num, ARENA_OPS(db));
 
 	num.str_size = fd->max_demangled_size + 1;
-	num.str_s = zalloc(db->cpp_ops, num.str_size);
-	CK(num.str_s != NULL);
+	num.str_s = xalloc(ARENA_OPS(db), num.str_size);
+	if (num.str_s == NULL) {
+		CK(B_FALSE);
+		return (first);
+	}
 
 	int n = 0;
 
@@ -2639,7 +2932,8 @@ parse_floating_literal(const char *first, const char *last, cpp_db_t *db)
 	}
 
 	num.str_len = n;
-	name_add_str(&db->cpp_name, &num, NULL);
+	CK(name_add_str(&db->cpp_name, &num, NULL));
+	str_fini(&num);
 
 	return (t + 1);
 }
@@ -2819,70 +3113,70 @@ parse_expr_primary(const char *first, const char *last, cpp_db_t *db)
  *                   ::= rS    # >>=
  *                   ::= v <digit> <source-name> # vendor extended operator
  */
-static struct {
-	const char code[3];
-	const char *op;
-} op_tbl[] = {
-	{ "aa", "operator&&" },
-	{ "ad", "operator&" },
-	{ "an", "operator&" },
-	{ "aN", "operator&=" },
-	{ "aS", "operator=" },
-	{ "cl", "operator()" },
-	{ "cm", "operator," },
-	{ "co", "operator~" },
-	{ "da", "operator delete[]" },
-	{ "de", "operator*" },
-	{ "dl", "operator delete" },
-	{ "dv", "operator/" },
-	{ "dV", "operator/=" },
-	{ "eo", "operator^" },
-	{ "eO", "operator^=" },
-	{ "eq", "operator==" },
-	{ "ge", "operator>=" },
-	{ "gt", "operator>" },
-	{ "ix", "operator[]" },
-	{ "le", "operator<=" },
-	{ "ls", "operator<<" },
-	{ "lS", "operator<<=" },
-	{ "lt", "operator<" },
-	{ "mi", "operator-" },
-	{ "mI", "operator-=" },
-	{ "ml", "operator*" },
-	{ "mL", "operator*=" },
-	{ "mm", "operator--" },
-	{ "na", "operator new[]" },
-	{ "ne", "operator!=" },
-	{ "ng", "operator-" },
-	{ "nt", "operator!" },
-	{ "nw", "operator new" },
-	{ "oo", "operator||" },
-	{ "or", "operator|" },
-	{ "oR", "operator|=" },
-	{ "pm", "operator->*" },
-	{ "pl", "operator+" },
-	{ "pL", "operator+=" },
-	{ "pp", "operator++" },
-	{ "ps", "operator+" },
-	{ "pt", "operator->" },
-	{ "qu", "operator?" },
-	{ "rm", "operator%" },
-	{ "rM", "operator%=" },
-	{ "rs", "operator>>" },
-	{ "rS", "operator>>=" }
+#define	OP(c0, c1, op) [CODE_ROW(c0)][CODE_COL(c1)] = op
+
+static const char *const op_tbl[CODE_ROWS][CODE_COLS] = {
+	OP('a', 'a', "operator&&"),
+	OP('a', 'd', "operator&"),
+	OP('a', 'n', "operator&"),
+	OP('a', 'N', "operator&="),
+	OP('a', 'S', "operator="),
+	OP('c', 'l', "operator()"),
+	OP('c', 'm', "operator,"),
+	OP('c', 'o', "operator~"),
+	OP('d', 'a', "operator delete[]"),
+	OP('d', 'e', "operator*"),
+	OP('d', 'l', "operator delete"),
+	OP('d', 'v', "operator/"),
+	OP('d', 'V', "operator/="),
+	OP('e', 'o', "operator^"),
+	OP('e', 'O', "operator^="),
+	OP('e', 'q', "operator=="),
+	OP('g', 'e', "operator>="),
+	OP('g', 't', "operator>"),
+	OP('i', 'x', "operator[]"),
+	OP('l', 'e', "operator<="),
+	OP('l', 's', "operator<<"),
+	OP('l', 'S', "operator<<="),
+	OP('l', 't', "operator<"),
+	OP('m', 'i', "operator-"),
+	OP('m', 'I', "operator-="),
+	OP('m', 'l', "operator*"),
+	OP('m', 'L', "operator*="),
+	OP('m', 'm', "operator--"),
+	OP('n', 'a', "operator new[]"),
+	OP('n', 'e', "operator!="),
+	OP('n', 'g', "operator-"),
+	OP('n', 't', "operator!"),
+	OP('n', 'w', "operator new"),
+	OP('o', 'o', "operator||"),
+	OP('o', 'r', "operator|"),
+	OP('o', 'R', "operator|="),
+	OP('p', 'm', "operator->*"),
+	OP('p', 'l', "operator+"),
+	OP('p', 'L', "operator+="),
+	OP('p', 'p', "operator++"),
+	OP('p', 's', "operator+"),
+	OP('p', 't', "operator->"),
+	OP('q', 'u', "operator?"),
+	OP('r', 'm', "operator%"),
+	OP('r', 'M', "operator%="),
+	OP('r', 's', "operator>>"),
+	OP('r', 'S', "operator>>=")
 };
+#undef OP
 
 static const char *
 parse_operator_name(const char *first, const char *last, cpp_db_t *db)
 {
+	const char *op;
+
 	if (last - first < 2)
 		return (first);
 
-	for (size_t i = 0; i < ARRAY_SIZE(op_tbl); i++) {
-		if (strncmp(first, op_tbl[i].code, 2) != 0)
-			continue;
-
-		nadd_l(db, op_tbl[i].op, 0);
+	if (is_code(first) &&
+	    (op = op_tbl[CODE_ROW(first[0])][CODE_COL(first[1])]) != NULL) {
+		nadd_l(db, op, 0);
 		return (first + 2);
 	}
 
@@ -2932,70 +3226,76 @@ struct type_tbl_s {
 	const char *name;
 };
 
-static struct type_tbl_s type_tbl1[] = {
-	{ 'a', "signed char" },
-	{ 'b', "bool" },
-	{ 'c', "char" },
-	{ 'd', "double" },
-	{ 'e', "long double" },
-	{ 'f', "float" },
-	{ 'g', "__float128" },
-	{ 'h', "unsigned char" },
-	{ 'i', "int" },
-	{ 'j', "unsigned int" },
-	{ 'l', "long" },
-	{ 'm', "unsigned long" },
-	{ 'n', "__int128" },
-	{ 'o', "unsigned __int128" },
-	{ 's', "short" },
-	{ 't', "unsigned short" },
-	{ 'v', "void" },
-	{ 'w', "wchar_t" },
-	{ 'x', "long long" },
-	{ 'y', "unsigned long long" },
-	{ 'z', "..." }
+/*
+ * The <builtin-type> names, indexed directly by the (unsigned) code byte so
+ * that parse_type() can recognize the common single character types with
+ * a single load.  type_tbl1 holds the single character codes, and
+ * type_tbl2 holds the D<char> codes indexed by their second character.
+ */
+#define	BT(c, name)	[(unsigned char)(c)] = (name)
+
+static const char *const type_tbl1[256] = {
+	BT('a', "signed char"),
+	BT('b', "bool"),
+	BT('c', "char"),
+	BT('d', "double"),
+	BT('e', "long double"),
+	BT('f', "float"),
+	BT('g', "__float128"),
+	BT('h', "unsigned char"),
+	BT('i', "int"),
+	BT('j', "unsigned int"),
+	BT('l', "long"),
+	BT('m', "unsigned long"),
+	BT('n', "__int128"),
+	BT('o', "unsigned __int128"),
+	BT('s', "short"),
+	BT('t', "unsigned short"),
+	BT('v', "void"),
+	BT('w', "wchar_t"),
+	BT('x', "long long"),
+	BT('y', "unsigned long long"),
+	BT('z', "...")
 };
 
-static struct type_tbl_s type_tbl2[] = {
-	{ 'a', "auto" },
-	{ 'c', "decltype(auto)" },
-	{ 'd', "decimal64" },
-	{ 'e', "decimal128" },
-	{ 'f', "decimal32" },
-	{ 'h', "decimal16" },
-	{ 'i', "char32_t" },
-	{ 'n', "std::nullptr_t" },
-	{ 's', "char16_t" }
+static const char *const type_tbl2[256] = {
+	BT('a', "auto"),
+	BT('c', "decltype(auto)"),
+	BT('d', "decimal64"),
+	BT('e', "decimal128"),
+	BT('f', "decimal32"),
+	BT('h', "decimal16"),
+	BT('i', "char32_t"),
+	BT('n', "std::nullptr_t"),
+	BT('s', "char16_t")
 };
 
+#undef BT
+
 static const char *
 parse_builtin_type(const char *first, const char *last, cpp_db_t *db)
 {
+	const char *name, *t;
+
 	if (first == last)
 		return (first);
 
-	size_t i;
-
-	for (i = 0; i < ARRAY_SIZE(type_tbl1); i++) {
-		if (first[0] == type_tbl1[i].code) {
-			nadd_l(db, type_tbl1[i].name, 0);
-			return (first + 1);
-		}
+	if ((name = type_tbl1[(unsigned char)first[0]]) != NULL) {
+		nadd_l(db, name, 0);
+		return (first + 1);
 	}
 
-	if (first[0] == 'D') {
+	switch (first[0]) {
+	case 'D':
 		if (first + 1 == last)
 			return (first);
-		for (i = 0; i < ARRAY_SIZE(type_tbl2); i++) {
-			if (first[1] == type_tbl2[i].code) {
-				nadd_l(db, type_tbl2[i].name, 0);
-				return (first + 2);
-			}
-		}
-	}
+		if ((name = type_tbl2[(unsigned char)first[1]]) == NULL)
+			return (first);
+		nadd_l(db, name, 0);
+		return (first + 2);
 
-	if (first[0] == 'u') {
-		const char *t = parse_source_name(first + 1, last, db);
+	case 'u':
+		t = parse_source_name(first + 1, last, db);
 		if (t == first + 1)
 			return (first);
 		return (t);
@@ -3053,7 +3353,7 @@ parse_substitution(const char *first, const char *last, cpp_db_t *db)
 
 	if (t[0] != '_') {
 		t = parse_base36(first + 1, last, &n);
-		if (t == first + 1 || t[0] != '_')
+		if (t == first + 1 || t == last || t[0] != '_')
 			return (first);
 
 		/*
@@ -3088,10 +3388,10 @@ parse_source_name(const char *first, const char *last, cpp_db_t *db)
 		n *= 10;
 		n += t[0] - '0';
 	}
-	if (n == 0 || t == last || t + n > last)
+	if (n == 0 || t == last || (size_t)(last - t) < n)
 		return (first);
 
-	if (strncmp(t, "_GLOBAL__N", 10) == 0)
+	if (n >= 10 && strncmp(t, "_GLOBAL__N", 10) == 0)
 		nadd_l(db, "(anonymous namespace)", 0);
 	else
 		nadd_l(db, t, n);
@@ -3143,7 +3443,7 @@ parse_vector_type(const char *first, const char *last, cpp_db_t *db)
 
 	if (first[2] != '_') {
 		t1 = parse_expression(first + 2, last, db);
-		if (first == last || t1 == first + 2 || t1[0] != '_')
+		if (t1 == first + 2 || t1 == last || t1[0] != '_')
 			return (first);
 
 		/* skip _ */
@@ -3231,9 +3531,12 @@ parse_array_type(const char *first, const char *last, cpp_db_t *db)
 	 * if we have  " [xxx]" already, want new result to be
 	 * " [yyy][xxx]"
 	 */
+	if (nempty(db))
+		return (first);
+
 	str_t *r = &name_top(&db->cpp_name)->strp_r;
-	if (r->str_len > 1 && r->str_s[0] == ' ' && r->str_s[1] == '[')
-		str_erase(r, 0, 1);
+	if (r->str_len > 1 && STR_DATA(r)[0] == ' ' && STR_DATA(r)[1] == '[')
+		CK(str_erase(r, 0, 1));
 
 	nfmt(db, "{0:L}", " [{1}]{0:R}");
 	return (t1);
@@ -3257,12 +3560,12 @@ parse_pointer_to_member_type(const char *first, const char *last, cpp_db_t *db)
 
 	t1 = t2;
 	t2 = parse_type(t1, last, db);
-	if (t1 == t2)
+	if (t1 == t2 || nempty(db))
 		return (first);
 
 	str_pair_t *func = name_top(&db->cpp_name);
 
-	if (str_length(&func->strp_r) > 0 && func->strp_r.str_s[0] == '(')
+	if (str_length(&func->strp_r) > 0 && STR_DATA(&func->strp_r)[0] == '(')
 		nfmt(db, "{0:L}({1}::*", "){0:R}");
 	else
 		nfmt(db, "{0:L} {1}::*", "{0:R}");
@@ -3307,16 +3610,16 @@ parse_unresolved_name(const char *first, const char *last, cpp_db_t *db)
 			if (nempty(db))
 				return (first);
 
-			str_insert(TOP_L(db), 0, "::", 2);
+			CK(str_insert(TOP_L(db), 0, "::", 2));
 		}
 		return (t2);
 	}
 
-	if (t[0] != 's' || t[1] != 'r' || last - t < 2)
+	if (last - t < 2 || t[0] != 's' || t[1] != 'r')
 		return (first);
 
 	n = nlen(db);
-	if (t[2] == 'N') {
+	if (last - t > 2 && t[2] == 'N') {
 		t += 3;
 		t2 = parse_unresolved_type(t, last, db);
 		if (t2 == t || t2 == last)
@@ -3332,14 +3635,17 @@ parse_unresolved_name(const char *first, const char *last, cpp_db_t *db)
 			t = t2;
 		}
 
-		while (t[0] != 'E') {
+		while (t != last && t[0] != 'E') {
 			t2 = parse_unresolved_qualifier_level(t, last, db);
-			if (t == t2 || t == last || nlen(db) < 2)
+			if (t == t2 || nlen(db) < 2)
 				return (first);
 
 			t = t2;
 		}
 
+		if (t == last)
+			return (first);
+
 		/* skip E */
 		t++;
 
@@ -3377,14 +3683,17 @@ parse_unresolved_name(const char *first, const char *last, cpp_db_t *db)
 	if (global && nlen(db) > 0)
 		nfmt(db, "::{0:L}", "{0:R}");
 
-	while (t[0] != 'E') {
+	while (t != last && t[0] != 'E') {
 		t2 = parse_unresolved_qualifier_level(t, last, db);
-		if (t == t2 || t == last || nlen(db) < 2)
+		if (t == t2 || nlen(db) < 2)
 			return (first);
 
 		t = t2;
 	}
 
+	if (t == last)
+		return (first);
+
 	/* skip E */
 	t++;
 
@@ -3599,7 +3908,11 @@ parse_template_param(const char *first, const char *last, cpp_db_t *db)
 		return (first);
 
 	if (idx >= ttlen(db)) {
+		const char mark = FWD_MARK;
+
 		nadd_l(db, first, (size_t)(t - first));
+		if (db->cpp_fwd_mark && db->cpp_err == 0)
+			CK(str_insert(TOP_L(db), 0, &mark, 1));
 		db->cpp_fix_forward_references = B_TRUE;
 		return (t);
 	}
@@ -3615,16 +3928,16 @@ parse_template_param(const char *first, const char *last, cpp_db_t *db)
 static const char *
 parse_template_args(const char *first, const char *last, cpp_db_t *db)
 {
-	if (last - first < 2 || first[0] != 'I')
+	if (last - first < 2 || first[0] != 'I' || db->cpp_err != 0)
 		return (first);
 
 	if (db->cpp_tag_templates)
-		sub_clear(templ_top(&db->cpp_templ));
+		templ_clear_top(&db->cpp_templ);
 
 	const char *t = first + 1;
 	size_t n = nlen(db);
 
-	while (t[0] != 'E') {
+	while (t != last && t[0] != 'E') {
 		if (db->cpp_tag_templates)
 			tpush(db);
 
@@ -3643,14 +3956,16 @@ parse_template_args(const char *first, const char *last, cpp_db_t *db)
 		t = t1;
 	}
 
+	if (t == last)
+		return (first);
+
 	/*
 	 * ugly, but if the last thing pushed was an empty string,
 	 * get rid of it so we dont get "..., "
 	 */
 	str_pair_t *sp = name_top(&db->cpp_name);
-	size_t len = str_pair_len(sp);
 
-	if (len == 0)
+	if (sp != NULL && str_pair_len(sp) == 0)
 		(void) name_pop(&db->cpp_name, NULL);
 
 	if (NAMT(db, n) == 0)
@@ -3659,7 +3974,8 @@ parse_template_args(const char *first, const char *last, cpp_db_t *db)
 		njoin(db, NAMT(db, n), ", ");
 	
 	/* make sure we don't bitshift ourselves into oblivion */
-	if (TOP_L(db)->str_s[TOP_L(db)->str_len - 1] == '>')
+	if (TOP_L(db)->str_len > 0 &&
+	    STR_DATA(TOP_L(db))[TOP_L(db)->str_len - 1] == '>')
 		nfmt(db, "<{0} >", NULL);
 	else
 		nfmt(db, "<{0}>", NULL);
@@ -3747,10 +4063,13 @@ parse_number(const char *first, const char *last)
 	if (t[0] == 'n')
 		t++;
 
+	if (t == last)
+		return (first);
+
 	if (t[0] == '0')
 		return (t + 1);
 
-	while (is_digit(t[0]))
+	while (t != last && is_digit(t[0]))
 		t++;
 
 	return (t);
@@ -3775,6 +4094,23 @@ is_upper(int c)
 	return (B_TRUE);
 }
 
+static inline boolean_t
+is_lower(int c)
+{
+	if (c < 'a' || c > 'z')
+		return (B_FALSE);
+	return (B_TRUE);
+}
+
+/* can s (which must have at least 2 characters) be an operator code? */
+static inline boolean_t
+is_code(const char *s)
+{
+	if (!is_lower(s[0]) || (!is_lower(s[1]) && !is_upper(s[1])))
+		return (B_FALSE);
+	return (B_TRUE);
+}
+
 static inline boolean_t
 is_xdigit(int c)
 {
@@ -3795,9 +4131,27 @@ nlen(cpp_db_t *db)
 	return (name_len(&db->cpp_name));
 }
 
+/*
+ * The left side of the top of the name stack.  If an allocation failure
+ * has left the stack empty, a dummy string is returned instead.
+ */
+static str_t *
+top_l(cpp_db_t *db)
+{
+	if (nempty(db)) {
+		ASSERT3U(db->cpp_err, !=, 0);
+		return (&db->cpp_dummy);
+	}
+
+	return (&name_top(&db->cpp_name)->strp_l);
+}
+
 static void
 nadd_l(cpp_db_t *db, const char *s, size_t len)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(name_add(&db->cpp_name, s, len, NULL, 0));
 }
 
@@ -3806,24 +4160,36 @@ njoin(cpp_db_t *db, size_t amt, const char *sep)
 {
 	name_t *nm = &db->cpp_name;
 
+	if (db->cpp_err != 0)
+		return;
+
 	CK(name_join(nm, amt, sep));
 }
 
 static void
 nfmt(cpp_db_t *db, const char *fmt_l, const char *fmt_r)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(name_fmt(&db->cpp_name, fmt_l, fmt_r));
 }
 
 static void
 save_top(cpp_db_t *db, size_t amt)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(sub_save(&db->cpp_subs, &db->cpp_name, amt));
 }
 
 static void
 sub(cpp_db_t *db, size_t n)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(sub_substitute(&db->cpp_subs, n, &db->cpp_name));
 }
 
@@ -3842,46 +4208,236 @@ ttlen(const cpp_db_t *db)
 static void
 tsub(cpp_db_t *db, size_t n)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(templ_sub(&db->cpp_templ, n, &db->cpp_name));
 }
 
 static void
 tpush(cpp_db_t *db)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(templ_push(&db->cpp_templ));
 }
 
+/*
+ * After a failure, the pushes and pops may no longer match up, so leave
+ * the stack alone (db_reset() will clean it up) to ensure the outermost
+ * template parameter list is never popped.
+ */
 static void
 tpop(cpp_db_t *db)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	templ_pop(&db->cpp_templ);
 }
 
 static void
 tsave(cpp_db_t *db, size_t amt)
 {
+	if (db->cpp_err != 0)
+		return;
+
 	CK(templ_save(&db->cpp_name, amt, &db->cpp_templ));
 }
 
+/*
+ * Parse the index of the forward reference (see FWD_MARK) at the start of
+ * [p, end).  Returns a pointer past the reference, or NULL if p does not
+ * point at one.
+ */
+static const char *
+fwd_ref_idx(const char *p, const char *end, size_t *idxp)
+{
+	size_t idx = 0;
+
+	if (end - p < 3 || p[0] != FWD_MARK || p[1] != 'T')
+		return (NULL);
+
+	if (p[2] == '_') {
+		*idxp = 0;
+		return (p + 3);
+	}
+
+	for (p += 2; p < end && is_digit(p[0]); p++)
+		idx = idx * 10 + p[0] - '0';
+
+	if (p == end || p[0] != '_')
+		return (NULL);
+
+	*idxp = idx + 1;
+	return (p + 1);
+}
+
+/* Leave the unresolved forward references in s as their mangled form */
+static void
+strip_forward_refs(cpp_db_t *db, str_t *s)
+{
+	const char *mark;
+	size_t i = 0;
+
+	while (i < s->str_len && (mark = memchr(STR_DATA(s) + i, FWD_MARK,
+	    s->str_len - i)) != NULL) {
+		i = (size_t)(mark - STR_DATA(s));
+		CK(str_erase(s, i, 1));
+		if (db->cpp_err != 0)
+			return;
+	}
+}
+
+/*
+ * Replace the forward references in the (merged) name on top of the stack
+ * with the outermost template arguments, producing the same result as
+ * parsing the name a second time with those arguments already known.
+ * Returns B_FALSE without changing anything if any of the arguments cannot
+ * be substituted as plain text (i.e. they have a right hand part, as
+ * function pointers do), in which case the name must be parsed again.
+ */
+static boolean_t
+fix_forward_refs(cpp_db_t *db)
+{
+	const templ_t *tpl = &db->cpp_templ;
+	size_t nargs = templ_frame_len(tpl, 0);
+	const str_pair_t *arg;
+	const char *p, *end, *next;
+	size_t idx, np;
+
+	if (!db->cpp_fwd_mark)
+		return (B_FALSE);
+
+	njoin(db, 0, "");
+	if (db->cpp_err != 0 || nempty(db))
+		return (B_TRUE);
+
+	str_t *s = TOP_L(db);
+
+	end = STR_DATA(s) + s->str_len;
+	for (p = STR_DATA(s); p < end; p = next) {
+		if ((next = fwd_ref_idx(p, end, &idx)) == NULL) {
+			next = p + 1;
+			continue;
+		}
+
+		if (idx >= nargs) {
+			errno = EINVAL;
+			return (B_TRUE);
+		}
+
+		arg = templ_arg(tpl, 0, idx, &np);
+		if (np != 1 || str_length(&arg->strp_r) != 0)
+			return (B_FALSE);
+	}
+
+	str_t res;
+
+	str_init(&res, ARENA_OPS(db));
+	end = STR_DATA(s) + s->str_len;
+	for (p = STR_DATA(s); p < end; p = next) {
+		const char *mark = memchr(p, FWD_MARK, (size_t)(end - p));
+
+		if (mark == NULL)
+			mark = end;
+
+		CK(str_append(&res, p, (size_t)(mark - p)));
+		if (mark == end)
+			break;
+
+		if ((next = fwd_ref_idx(mark, end, &idx)) == NULL) {
+			next = mark + 1;
+			continue;
+		}
+
+		size_t start = res.str_len;
+
+		arg = templ_arg(tpl, 0, idx, &np);
+		CK(str_append_str(&res, &arg->strp_l));
+		if (db->cpp_err != 0)
+			break;
+
+		/* as parse_template_args() does, avoid ">>" */
+		if (next < end && next[0] == '>' && res.str_len > start &&
+		    STR_DATA(&res)[res.str_len - 1] == '>')
+			CK(str_append_c(&res, ' '));
+	}
+
+	/*
+	 * The arguments may contain forward references of their own.  Those
+	 * are never resolved (a reparse would just copy them from the
+	 * arguments again), so they are stripped by cpp_parse().
+	 */
+	if (db->cpp_err == 0) {
+		str_fini(s);
+		*s = res;
+	} else {
+		str_fini(&res);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Everything a parse allocates (the name, substitution, and template
+ * stacks and all of their strings) comes from db->cpp_arena, which is
+ * created on first use.  Nothing is freed individually; db_reset() releases
+ * it all at once by resetting the arena, whose chunks are then reused by
+ * the next parse.  Only the db itself and the copies of the results handed
+ * back to callers use cpp_ops directly.
+ */
+#ifndef CPP_ARENA_CHUNK_SZ
+#define	CPP_ARENA_CHUNK_SZ	(16U * 1024U)
+#endif
+
 static void
 db_init(cpp_db_t *db, sysdem_ops_t *ops)
 {
 	(void) memset(db, 0, sizeof (*db));
 	db->cpp_ops = ops;
-	name_init(&db->cpp_name, ops);
-	sub_init(&db->cpp_subs, ops);
-	templ_init(&db->cpp_templ, ops);
 	db->cpp_tag_templates = B_TRUE;
 	db->cpp_try_to_parse_template_args = B_TRUE;
-	tpush(db);
+}
+
+/*
+ * Return db to the state db_init() left it in, except that the arena (and
+ * the memory it has accumulated) is kept.  db->cpp_arena is NULL on return
+ * if it could not be created.
+ */
+static void
+db_reset(cpp_db_t *db)
+{
+	if (db->cpp_arena == NULL) {
+		db->cpp_arena = sysdem_arena_create(db->cpp_ops,
+		    CPP_ARENA_CHUNK_SZ);
+		if (db->cpp_arena == NULL)
+			return;
+	} else {
+		sysdem_arena_reset(db->cpp_arena);
+	}
+
+	name_init(&db->cpp_name, ARENA_OPS(db));
+	sub_init(&db->cpp_subs, ARENA_OPS(db));
+	templ_init(&db->cpp_templ, ARENA_OPS(db));
+	str_init(&db->cpp_dummy, ARENA_OPS(db));
+
+	db->cpp_err = 0;
+	db->cpp_cv = 0;
+	db->cpp_ref = 0;
+	db->cpp_depth = 0;
+	db->cpp_parsed_ctor_dtor_cv = B_FALSE;
+	db->cpp_tag_templates = B_TRUE;
+	db->cpp_fix_forward_references = B_FALSE;
+	db->cpp_try_to_parse_template_args = B_TRUE;
+	db->cpp_fwd_mark = B_FALSE;
 }
 
 static void
 db_fini(cpp_db_t *db)
 {
-	name_fini(&db->cpp_name);
-	sub_fini(&db->cpp_subs);
-	templ_fini(&db->cpp_templ);
+	sysdem_arena_destroy(db->cpp_arena);
 	(void) memset(db, 0, sizeof (*db));
 }
 
@@ -3889,8 +4445,8 @@ static void
 print_sp(const str_pair_t *sp, FILE *out)
 {
 	(void) fprintf(out, "{%.*s#%.*s}",
-	    (int) sp->strp_l.str_len, sp->strp_l.str_s,
-	    (int) sp->strp_r.str_len, sp->strp_r.str_s);
+	    (int) sp->strp_l.str_len, STR_DATA(&sp->strp_l),
+	    (int) sp->strp_r.str_len, STR_DATA(&sp->strp_r));
 }
 
 static void
@@ -3987,9 +4543,10 @@ print_templ(const templ_t *tpl, FILE *out)
 
 	(void) fprintf(out, "Template\n");
 
-	const sub_t *s = templ_top((templ_t *)tpl);
+	if (templ_empty(tpl))
+		return;
 
-	for (size_t i = 0; i < s->sub_len; i++) {
+	for (size_t i = 0; i < templ_top_len(tpl); i++) {
 		char buf[16] = { 0 };
 
 		if (i == 0)
@@ -4001,16 +4558,16 @@ print_templ(const templ_t *tpl, FILE *out)
 
 		(void) fputc('{', out);
 
-		const name_t *n = &s->sub_items[i];
-		for (size_t j = 0; j < n->nm_len; j++) {
-			const str_pair_t *sp = &n->nm_items[j];
+		size_t np;
+		const str_pair_t *sp = templ_arg(tpl, tpl->tpl_len - 1, i, &np);
 
+		for (size_t j = 0; j < np; j++, sp++) {
 			if (j > 0)
 				(void) fputc(' ', out);
 
 			(void) fprintf(out, "{%.*s#%.*s}",
-			       (int)sp->strp_l.str_len, sp->strp_l.str_s,
-			       (int)sp->strp_r.str_len, sp->strp_r.str_s);
+			       (int)sp->strp_l.str_len, STR_DATA(&sp->strp_l),
+			       (int)sp->strp_r.str_len, STR_DATA(&sp->strp_r));
 		}
 		(void) fprintf(out, "}\n");
 	}
@@ -55,28 +55,34 @@ void sub_clear(sub_t *);
 void sub_init(sub_t *, sysdem_ops_t *);
 void sub_fini(sub_t *);
 void sub_pop(sub_t *);
-boolean_t sub_save(sub_t *, const name_t *, size_t);
+boolean_t sub_save(sub_t *, name_t *, size_t);
 boolean_t sub_substitute(const sub_t *, size_t, name_t *);
 boolean_t sub_empty(const sub_t *);
 size_t sub_len(const sub_t *);
 
 typedef struct templ_s {
-	sub_t		*tpl_items;
-	sysdem_ops_t	*tpl_ops;
+	name_t		tpl_pairs;	/* str_pairs of all saved args */
+	size_t		*tpl_args;	/* tpl_pairs index of each arg */
+	size_t		tpl_nargs;
+	size_t		tpl_args_size;
+	size_t		*tpl_frames;	/* tpl_args index of each frame */
 	size_t		tpl_len;
 	size_t		tpl_size;
+	sysdem_ops_t	*tpl_ops;
 } templ_t;
 
 void templ_init(templ_t *, sysdem_ops_t *);
 void templ_fini(templ_t *);
 boolean_t templ_empty(const templ_t *);
 size_t templ_top_len(const templ_t *);
+size_t templ_frame_len(const templ_t *, size_t);
+const str_pair_t *templ_arg(const templ_t *, size_t, size_t, size_t *);
 boolean_t templ_sub(const templ_t *, size_t, name_t *);
-boolean_t templ_save(const name_t *, size_t, templ_t *);
+boolean_t templ_save(name_t *, size_t, templ_t *);
 
 boolean_t templ_push(templ_t *);
 void templ_pop(templ_t *);
-sub_t *templ_top(templ_t *);
+void templ_clear_top(templ_t *);
 
 #ifdef __cplusplus
 }
@@ -19,7 +19,9 @@
 #include "sysdemangle_int.h"
 #include "cpp.h"
 
+#ifndef CHUNK_SIZE
 #define CHUNK_SIZE  (8U)
+#endif
 
 /*
  * A name_t is essentially a stack of str_pair_t's.  Generally, the parsing
@@ -48,7 +50,7 @@ name_fini(name_t *n)
 		return;
 
 	name_clear(n);
-	xfree(n->nm_ops, n->nm_items, n->nm_size);
+	xfree(n->nm_ops, n->nm_items, n->nm_size * sizeof (str_pair_t));
 	n->nm_items = NULL;
 	n->nm_size = 0;
 }
@@ -83,14 +85,14 @@ name_clear(name_t *n)
 }
 
 static boolean_t
-name_reserve(name_t *n, size_t amt)
+name_reserve_chunk(name_t *n, size_t amt, size_t chunk)
 {
 	size_t newlen = n->nm_len + amt;
 
-	if (newlen < n->nm_size)
+	if (newlen <= n->nm_size)
 		return (B_TRUE);
 
-	size_t newsize = roundup(newlen, CHUNK_SIZE);
+	size_t newsize = grow_size(n->nm_size, newlen, chunk);
 	void *temp = xrealloc(n->nm_ops, n->nm_items,
 	    n->nm_size * sizeof (str_pair_t), newsize * sizeof (str_pair_t));
 
@@ -102,6 +104,12 @@ name_reserve(name_t *n, size_t amt)
 	return (B_TRUE);
 }
 
+static boolean_t
+name_reserve(name_t *n, size_t amt)
+{
+	return (name_reserve_chunk(n, amt, CHUNK_SIZE));
+}
+
 boolean_t
 name_add(name_t *n, const char *l, size_t l_len, const char *r, size_t r_len)
 {
@@ -118,25 +126,23 @@ name_add(name_t *n, const char *l, size_t l_len, const char *r, size_t r_len)
 boolean_t
 name_add_str(name_t *n, str_t *l, str_t *r)
 {
-	str_pair_t sp;
-
-	str_pair_init(&sp, n->nm_ops);
+	str_pair_t *sp;
 
 	if (!name_reserve(n, 1))
 		return (B_FALSE);
 
+	sp = str_pair_init(&n->nm_items[n->nm_len++], n->nm_ops);
+
 	if (l != NULL) {
-		sp.strp_l = *l;
+		sp->strp_l = *l;
 		(void) memset(l, 0, sizeof (*l));
 	}
 
 	if (r != NULL) {
-		sp.strp_r = *r;
+		sp->strp_r = *r;
 		(void) memset(r, 0, sizeof (*r));
 	}
 
-	n->nm_items[n->nm_len++] = sp;
-
 	return (B_TRUE);
 }
 
@@ -175,12 +181,29 @@ name_pop(name_t *n, str_pair_t *sp)
 	return (sp);
 }
 
+static void
+str_append_raw(str_t *s, const char *src, size_t len)
+{
+	if (len == 0)
+		return;
+
+	(void) memcpy(STR_DATA(s) + s->str_len, src, len);
+	s->str_len += len;
+}
+
+/*
+ * Replace the top amt elements of n with a single element holding their
+ * contents (left then right piece of each) separated by sep.  The length
+ * of the result is computed first, and the result is built in the buffer
+ * of the first element's left piece, grown once to the final size.
+ */
 boolean_t
 name_join(name_t *n, size_t amt, const char *sep)
 {
 	str_pair_t *sp = NULL;
-	str_t res = { 0 };
+	str_t res;
 	size_t seplen = strlen(sep);
+	size_t len;
 
 	ASSERT3U(amt, <=, n->nm_len);
 
@@ -192,90 +215,152 @@ name_join(name_t *n, size_t amt, const char *sep)
 		return (B_TRUE);
 	}
 
-	(void) str_init(&res, n->nm_ops);
-
 	sp = name_at(n, amt - 1);
-	for (size_t i = 0; i < amt; i++) {
-		if (i > 0) {
-			if (!str_append(&res, sep, seplen))
-				goto error;
-		}
 
-		if (!str_append_str(&res, &sp->strp_l))
-			goto error;
-		if (!str_append_str(&res, &sp->strp_r))
-			goto error;
+	len = seplen * (amt - 1);
+	for (size_t i = 0; i < amt; i++)
+		len += str_pair_len(&sp[i]);
+
+	/*
+	 * Take over the first left piece.  If it is a reference, str_reserve()
+	 * copies it.  Nothing is changed if that fails, so the name is left
+	 * intact.
+	 */
+	res = sp->strp_l;
+	if (len > res.str_len && !str_reserve(&res, len - res.str_len))
+		return (B_FALSE);
+
+	str_init(&sp->strp_l, n->nm_ops);
+	str_append_raw(&res, STR_DATA(&sp->strp_r), sp->strp_r.str_len);
 
-		sp++;
+	for (size_t i = 1; i < amt; i++) {
+		str_append_raw(&res, sep, seplen);
+		str_append_raw(&res, STR_DATA(&sp[i].strp_l),
+		    sp[i].strp_l.str_len);
+		str_append_raw(&res, STR_DATA(&sp[i].strp_r),
+		    sp[i].strp_r.str_len);
 	}
 
 	for (size_t i = 0; i < amt; i++)
 		(void) name_pop(n, NULL);
 
-	/* since we've removed at least 1 entry, this should always succeed */
-	VERIFY(name_add_str(n, &res, NULL));
+	/*
+	 * Since we've removed at least 1 entry, this should always succeed,
+	 * but it can't be a VERIFY() since that compiles away with NDEBUG.
+	 */
+	if (!name_add_str(n, &res, NULL)) {
+		str_fini(&res);
+		return (B_FALSE);
+	}
 	return (B_TRUE);
-
-error:
-	str_fini(&res);
-	return (B_FALSE);
 }
 
-static boolean_t
-name_fmt_s(name_t *n, str_t *s, const char *fmt, long *maxp)
+/*
+ * The pieces (literal text or strings from the stack) a format expands to.
+ * No format used by the demangler has more than a handful.
+ */
+#define	FMT_MAX_PIECES	(16U)
+
+typedef struct fmt_piece_s {
+	const char	*fp_s;
+	size_t		fp_len;
+	const str_t	*fp_str;	/* the string, if not literal text */
+} fmt_piece_t;
+
+/*
+ * Decode fmt into its non-empty pieces in a single pass, without copying
+ * anything.  Returns the number of pieces, setting *lenp to their total
+ * length and updating *maxp with the deepest element referenced.
+ */
+static size_t
+fmt_decode(name_t *n, const char *fmt, fmt_piece_t *pieces, size_t *lenp,
+    long *maxp)
 {
-	const char *p;
-	long max = -1;
+	const char *p = fmt;
+	size_t np = 0;
 
+	*lenp = 0;
 	if (fmt == NULL)
-		return (B_TRUE);
+		return (0);
 
-	for (p = fmt; *p != '\0'; p++) {
+	while (*p != '\0') {
 		if (*p != '{') {
-			str_append_c(s, *p);
+			const char *lit = p;
+
+			while (*p != '\0' && *p != '{')
+				p++;
+
+			VERIFY(np < FMT_MAX_PIECES);
+			pieces[np].fp_s = lit;
+			pieces[np].fp_len = (size_t)(p - lit);
+			pieces[np].fp_str = NULL;
+			*lenp += pieces[np++].fp_len;
 			continue;
 		}
 
-		errno = 0;
-		char *q = NULL;
-		long val = strtol(p + 1, &q, 10);
+		size_t idx = 0;
+		char part = '\0';
 
-		ASSERT(val != 0 || errno == 0);
-		ASSERT3U(val, <, n->nm_len);
+		for (p++; *p >= '0' && *p <= '9'; p++)
+			idx = idx * 10 + *p - '0';
 
-		str_pair_t *sp = name_at(n, val);
+		if (*p == ':') {
+			part = p[1];
+			p += 2;
+		}
 
-		if (val > max)
-			max = val;
+		VERIFY(*p == '}');
+		p++;
 
-		switch (q[0]) {
-		case '}':
-			if (!str_append_str(s, &sp->strp_l))
-				return (B_FALSE);
-			if (!str_append_str(s, &sp->strp_r))
-				return (B_FALSE);
-			p = q;
-			continue;
-		case ':':
-			switch (q[1]) {
-			case 'L':
-				if (!str_append_str(s, &sp->strp_l))
-					return (B_FALSE);
-				break;
-			case 'R':
-				if (!str_append_str(s, &sp->strp_r))
-					return (B_FALSE);
-				break;
-			}
-
-			p = q + 2;
-			VERIFY(*p == '}');
-			break;
+		ASSERT3U(idx, <, n->nm_len);
+		if ((long)idx > *maxp)
+			*maxp = idx;
+
+		str_pair_t *sp = name_at(n, idx);
+		const str_t *strs[2] = {
+			(part == 'R') ? &sp->strp_r : &sp->strp_l,
+			(part == '\0') ? &sp->strp_r : NULL
+		};
+
+		for (size_t i = 0; i < 2 && strs[i] != NULL; i++) {
+			if (str_length(strs[i]) == 0)
+				continue;
+
+			VERIFY(np < FMT_MAX_PIECES);
+			pieces[np].fp_s = STR_DATA(strs[i]);
+			pieces[np].fp_len = strs[i]->str_len;
+			pieces[np].fp_str = strs[i];
+			*lenp += pieces[np++].fp_len;
 		}
 	}
 
-	if (*maxp < max)
-		*maxp = max;
+	return (np);
+}
+
+/*
+ * Append the result of fmt to s, updating *maxp with the deepest element
+ * it references.  The format is decoded once, s is grown to the final size
+ * up front, and each piece is copied in one go.  A result that is just one
+ * string is appended with str_append_str() so it can share a reference.
+ */
+static boolean_t
+name_fmt_s(name_t *n, str_t *s, const char *fmt, long *maxp)
+{
+	fmt_piece_t pieces[FMT_MAX_PIECES];
+	size_t len;
+	size_t np = fmt_decode(n, fmt, pieces, &len, maxp);
+
+	if (np == 1 && pieces[0].fp_str != NULL)
+		return (str_append_str(s, pieces[0].fp_str));
+
+	if (np == 0 || !str_reserve(s, len))
+		return (np == 0);
+
+	for (size_t i = 0; i < np; i++) {
+		(void) memcpy(STR_DATA(s) + s->str_len, pieces[i].fp_s,
+		    pieces[i].fp_len);
+		s->str_len += pieces[i].fp_len;
+	}
 
 	return (B_TRUE);
 }
@@ -326,9 +411,22 @@ error:
 
 /*
  * The substitution list is a list of name_t's that get added as the
- * demangled name is parsed.  Adding a name_t to the substitution list
- * is a copy operation, and likewise inserting a substitution into a name_t
- * is also a copy operation.
+ * demangled name is parsed.  Entries are never changed once saved, which
+ * lets them share memory with the strings they were saved from and with
+ * the strings they are substituted into instead of copying them:
+ * sub_save() takes over the buffers of the saved strings (leaving the
+ * originals as references to them), and sub_substitute() pushes references
+ * to the saved strings.  A string only gets its own copy if it is
+ * modified afterwards (see str_share()).  Since references do not keep
+ * what they refer to alive, the memory of the strings in a sub_t must
+ * not be freed while they might be in use.  The demangler allocates all
+ * of them from an arena that is only reset between names.
+ *
+ * Removing entries (sub_pop(), sub_clear()) only empties the name_t's --
+ * their nm_items arrays are kept (in sub_items[sub_len .. sub_size - 1])
+ * and reused by later sub_save() calls, so a sub_t that is cleared and
+ * refilled does not need to reallocate them.  Only sub_fini() releases
+ * them.
  */
 void
 sub_init(sub_t *sub, sysdem_ops_t *ops)
@@ -343,8 +441,10 @@ sub_fini(sub_t *sub)
 	if (sub == NULL)
 		return;
 
-	sub_clear(sub);
-	xfree(sub->sub_ops, sub->sub_items, sub->sub_size);
+	for (size_t i = 0; i < sub->sub_size; i++)
+		name_fini(&sub->sub_items[i]);
+
+	xfree(sub->sub_ops, sub->sub_items, sub->sub_size * sizeof (name_t));
 	sub->sub_items = NULL;
 	sub->sub_size = 0;
 }
@@ -356,7 +456,7 @@ sub_clear(sub_t *sub)
 		return;
 
 	for (size_t i = 0; i < sub->sub_len; i++)
-		name_fini(&sub->sub_items[i]);
+		name_clear(&sub->sub_items[i]);
 
 	sub->sub_len = 0;
 }
@@ -376,10 +476,11 @@ sub_len(const sub_t *sub)
 static boolean_t
 sub_reserve(sub_t *sub, size_t amt)
 {
-	if (sub->sub_len + amt < sub->sub_size)
+	if (sub->sub_len + amt <= sub->sub_size)
 		return (B_TRUE);
 
-	size_t newsize = roundup(sub->sub_size + amt, CHUNK_SIZE);
+	size_t newsize = grow_size(sub->sub_size, sub->sub_len + amt,
+	    CHUNK_SIZE);
 	void *temp = xrealloc(sub->sub_ops, sub->sub_items,
 	    sub->sub_size * sizeof (name_t), newsize * sizeof (name_t));
 
@@ -394,7 +495,7 @@ sub_reserve(sub_t *sub, size_t amt)
 
 /* save the element of n (up to depth elements deep) as a substitution */
 boolean_t
-sub_save(sub_t *sub, const name_t *n, size_t depth)
+sub_save(sub_t *sub, name_t *n, size_t depth)
 {
 	if (depth == 0)
 		return (B_TRUE);
@@ -403,87 +504,122 @@ sub_save(sub_t *sub, const name_t *n, size_t depth)
 		return (B_FALSE);
 
 	name_t *dest = &sub->sub_items[sub->sub_len++];
-	name_init(dest, sub->sub_ops);
 
-	if (!name_reserve(dest, depth)) {
-		name_fini(dest);
+	/* slots past sub_len are either zeroed or emptied, but reusable */
+	if (dest->nm_ops == NULL)
+		name_init(dest, sub->sub_ops);
+
+	/*
+	 * Saved substitutions are never added to, so (unless it's being
+	 * reused) size dest exactly instead of rounding up to CHUNK_SIZE.
+	 */
+	if (!name_reserve_chunk(dest, depth, 1)) {
 		sub->sub_len--;
 		return (B_FALSE);
 	}
 
-	const str_pair_t *src_sp = name_at((name_t *)n, depth - 1);
+	str_pair_t *src_sp = name_at(n, depth - 1);
 
 	for (size_t i = 0; i < depth; i++, src_sp++) {
-		str_pair_t copy = { 0 };
-		str_pair_init(&copy, n->nm_ops);
-		if (!str_pair_copy(src_sp, &copy)) {
-			str_pair_fini(&copy);
-			name_fini(dest);
-			return (B_FALSE);
-		}
+		str_pair_t *sp = &dest->nm_items[dest->nm_len++];
 
-		VERIFY(name_add_str(dest, &copy.strp_l, &copy.strp_r));
+		str_pair_init(sp, n->nm_ops);
+		str_share(&src_sp->strp_l, &sp->strp_l);
+		str_share(&src_sp->strp_r, &sp->strp_r);
 	}
 
 	return (B_TRUE);
 }
 
-/* push substitution idx onto n */
-boolean_t
-sub_substitute(const sub_t *sub, size_t idx, name_t *n)
+/*
+ * Push references to the count str_pair_t's starting at sp onto n.  See
+ * the comment above sub_init() for when this is safe.
+ */
+static boolean_t
+name_add_refs(name_t *n, const str_pair_t *sp, size_t count)
 {
-	const name_t *src = &sub->sub_items[idx];
-	const str_pair_t *sp = src->nm_items;
-	size_t save = name_len(n);
-
-	for (size_t i = 0; i < src->nm_len; i++, sp++) {
-		str_pair_t copy = { 0 };
+	if (!name_reserve(n, count))
+		return (B_FALSE);
 
-		if (!str_pair_copy(sp, &copy))
-			goto fail;
+	for (size_t i = 0; i < count; i++, sp++) {
+		str_pair_t *dest = &n->nm_items[n->nm_len++];
 
-		if (!name_add_str(n, &copy.strp_l, &copy.strp_r))
-			goto fail;
+		str_pair_init(dest, n->nm_ops);
+		if (str_length(&sp->strp_l) > 0)
+			str_ref(&sp->strp_l, &dest->strp_l);
+		if (str_length(&sp->strp_r) > 0)
+			str_ref(&sp->strp_r, &dest->strp_r);
 	}
-	
+
 	return (B_TRUE);
+}
 
-fail:
-	for (size_t i = 0; i < name_len(n) - save; i++)
-		(void) name_pop(n, NULL);
-	return (B_FALSE);
+/* push substitution idx onto n */
+boolean_t
+sub_substitute(const sub_t *sub, size_t idx, name_t *n)
+{
+	const name_t *src = &sub->sub_items[idx];
+
+	return (name_add_refs(n, src->nm_items, src->nm_len));
 }
 
 void
 sub_pop(sub_t *sub)
 {
 	name_t *top = &sub->sub_items[--sub->sub_len];
-	name_fini(top);
+	name_clear(top);
 }
 
+/*
+ * The template parameter list is a stack of frames, each holding the
+ * arguments of one template-args scope.  Only the top frame is ever added
+ * to (or cleared), so all of the arguments are kept in one array
+ * (tpl_args) in frame order, and a frame is just the index of its first
+ * argument.  Likewise each argument is the index in tpl_pairs of its
+ * first str_pair_t.  Pushing and popping frames only moves indices, and
+ * once the arrays have grown large enough, never allocates.  Like the
+ * substitution list, saved arguments share their strings with the name
+ * they were saved from and the names they are substituted into.
+ */
 static boolean_t
-templ_reserve(templ_t *tpl, size_t n)
+idx_reserve(sysdem_ops_t *ops, size_t **arrp, size_t len, size_t *sizep)
 {
-	if (tpl->tpl_len + n < tpl->tpl_size)
+	if (len + 1 <= *sizep)
 		return (B_TRUE);
 
-	size_t newsize = tpl->tpl_size + CHUNK_SIZE;
-	void *temp = xrealloc(tpl->tpl_ops, tpl->tpl_items,
-	    tpl->tpl_size * sizeof (sub_t), newsize * sizeof (sub_t));
+	size_t newsize = grow_size(*sizep, len + 1, CHUNK_SIZE);
+	void *temp = xrealloc_nz(ops, *arrp, *sizep * sizeof (size_t),
+	    newsize * sizeof (size_t));
 
 	if (temp == NULL)
 		return (B_FALSE);
 
-	tpl->tpl_items = temp;
-	tpl->tpl_size = newsize;
+	*arrp = temp;
+	*sizep = newsize;
 	return (B_TRUE);
 }
 
+/* discard all but the first nargs arguments */
+static void
+templ_truncate(templ_t *tpl, size_t nargs)
+{
+	if (nargs >= tpl->tpl_nargs)
+		return;
+
+	size_t npairs = tpl->tpl_args[nargs];
+
+	while (name_len(&tpl->tpl_pairs) > npairs)
+		(void) name_pop(&tpl->tpl_pairs, NULL);
+
+	tpl->tpl_nargs = nargs;
+}
+
 void
 templ_init(templ_t *tpl, sysdem_ops_t *ops)
 {
 	(void) memset(tpl, 0, sizeof (*tpl));
 	tpl->tpl_ops = ops;
+	name_init(&tpl->tpl_pairs, ops);
 }
 
 void
@@ -492,23 +628,22 @@ templ_fini(templ_t *tpl)
 	if (tpl == NULL)
 		return;
 
-	for (size_t i = 0; i < tpl->tpl_len; i++)
-		sub_fini(&tpl->tpl_items[i]);
-
-	xfree(tpl->tpl_ops, tpl->tpl_items, tpl->tpl_size * sizeof (sub_t));
 	sysdem_ops_t *ops = tpl->tpl_ops;
-	(void) memset(tpl, 0, sizeof (*tpl));
-	tpl->tpl_ops = ops;
+
+	name_fini(&tpl->tpl_pairs);
+	xfree(ops, tpl->tpl_args, tpl->tpl_args_size * sizeof (size_t));
+	xfree(ops, tpl->tpl_frames, tpl->tpl_size * sizeof (size_t));
+	templ_init(tpl, ops);
 }
 
 boolean_t
 templ_push(templ_t *tpl)
 {
-	if (!templ_reserve(tpl, 1))
+	if (!idx_reserve(tpl->tpl_ops, &tpl->tpl_frames, tpl->tpl_len,
+	    &tpl->tpl_size))
 		return (B_FALSE);
 
-	sub_t *sub = &tpl->tpl_items[tpl->tpl_len++];
-	sub_init(sub, tpl->tpl_ops);
+	tpl->tpl_frames[tpl->tpl_len++] = tpl->tpl_nargs;
 	return (B_TRUE);
 }
 
@@ -517,16 +652,15 @@ templ_pop(templ_t *tpl)
 {
 	ASSERT(!templ_empty(tpl));
 
-	sub_t *sub = &tpl->tpl_items[--tpl->tpl_len];
-	sub_fini(sub);
+	templ_truncate(tpl, tpl->tpl_frames[--tpl->tpl_len]);
 }
 
-sub_t *
-templ_top(templ_t *tpl)
+/* remove all of the arguments in the top frame */
+void
+templ_clear_top(templ_t *tpl)
 {
-	if (tpl->tpl_len == 0)
-		return (NULL);
-	return (&tpl->tpl_items[tpl->tpl_len - 1]);
+	if (tpl->tpl_len > 0)
+		templ_truncate(tpl, tpl->tpl_frames[tpl->tpl_len - 1]);
 }
 
 boolean_t
@@ -535,43 +669,84 @@ templ_empty(const templ_t *tpl)
 	return ((tpl->tpl_len == 0) ? B_TRUE : B_FALSE);
 }
 
+/* the number of arguments in frame (0 is the outermost) */
+size_t
+templ_frame_len(const templ_t *tpl, size_t frame)
+{
+	ASSERT3U(frame, <, tpl->tpl_len);
+
+	size_t end = (frame + 1 < tpl->tpl_len) ?
+	    tpl->tpl_frames[frame + 1] : tpl->tpl_nargs;
+
+	return (end - tpl->tpl_frames[frame]);
+}
+
 size_t
 templ_top_len(const templ_t *tpl)
 {
-	const sub_t *sub = templ_top((templ_t *)tpl);
+	return (templ_frame_len(tpl, tpl->tpl_len - 1));
+}
 
-	return (sub->sub_len);
+/*
+ * Return argument idx of frame, which consists of the *np str_pair_t's
+ * starting at the one returned.
+ */
+const str_pair_t *
+templ_arg(const templ_t *tpl, size_t frame, size_t idx, size_t *np)
+{
+	ASSERT3U(idx, <, templ_frame_len(tpl, frame));
+
+	size_t arg = tpl->tpl_frames[frame] + idx;
+	size_t end = (arg + 1 < tpl->tpl_nargs) ?
+	    tpl->tpl_args[arg + 1] : name_len(&tpl->tpl_pairs);
+
+	*np = end - tpl->tpl_args[arg];
+	return (&tpl->tpl_pairs.nm_items[tpl->tpl_args[arg]]);
 }
 
+/* push argument idx of the top frame onto n */
 boolean_t
 templ_sub(const templ_t *tpl, size_t idx, name_t *n)
 {
-	const sub_t *sub = templ_top((templ_t *)tpl);
+	const str_pair_t *sp;
+	size_t np;
 
-	return (sub_substitute(sub, idx, n));
+	sp = templ_arg(tpl, tpl->tpl_len - 1, idx, &np);
+	return (name_add_refs(n, sp, np));
 }
 
+/* save the top amt elements of n as the next argument of the top frame */
 boolean_t
-templ_save(const name_t *n, size_t amt, templ_t *tpl)
+templ_save(name_t *n, size_t amt, templ_t *tpl)
 {
 	ASSERT3U(tpl->tpl_len, >, 0);
 
-	sub_t *s = templ_top(tpl);
-	boolean_t res = B_TRUE;
+	name_t *pairs = &tpl->tpl_pairs;
+	size_t start = name_len(pairs);
+
+	if (!idx_reserve(tpl->tpl_ops, &tpl->tpl_args, tpl->tpl_nargs,
+	    &tpl->tpl_args_size))
+		return (B_FALSE);
 
 	/* a bit of a hack -- want an 'empty' entry when saving 0 params */
 	if (amt == 0) {
-		name_t name = { 0 };
-
-		name_init(&name, tpl->tpl_ops);
-		res &= name_add(&name, "", 0, "", 0);
-		if (res)
-			res &= sub_save(s, &name, 1);
-		name_fini(&name);
+		if (!name_add(pairs, NULL, 0, NULL, 0))
+			return (B_FALSE);
 	} else {
-		res &= sub_save(s, n, amt);
+		if (!name_reserve(pairs, amt))
+			return (B_FALSE);
+
+		str_pair_t *src_sp = name_at(n, amt - 1);
+
+		for (size_t i = 0; i < amt; i++, src_sp++) {
+			str_pair_t *sp = &pairs->nm_items[pairs->nm_len++];
+
+			str_pair_init(sp, pairs->nm_ops);
+			str_share(&src_sp->strp_l, &sp->strp_l);
+			str_share(&src_sp->strp_r, &sp->strp_r);
+		}
 	}
 
-	return (res);
+	tpl->tpl_args[tpl->tpl_nargs++] = start;
+	return (B_TRUE);
 }
-
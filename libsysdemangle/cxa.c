@@ -0,0 +1,142 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Copyright 2017 Jason King
+ */
+
+/*
+ * A drop-in replacement for the C++ ABI's __cxa_demangle(), so existing
+ * callers of abi::__cxa_demangle() can use this library unchanged by
+ * linking against (or LD_PRELOADing) libsysdemangle_cxa.  The contract is
+ * the one implemented by cxa_demangle.cpp:
+ *
+ * mangled is demangled into buf, which must be NULL or a malloc()ed
+ * buffer of *n bytes.  If the result (including its NUL) doesn't fit, buf
+ * is realloc()ed and the new size is stored in *n (if n isn't NULL).  On
+ * success, the (possibly moved) buffer is returned.  On failure, NULL is
+ * returned and buf is left alone; it still belongs to the caller.  Either
+ * way, *status (if status isn't NULL) is set to one of the CXA_* codes.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sysdemangle.h"
+#include "sysdemangle_int.h"
+
+#define	CXA_SUCCESS		0
+#define	CXA_NOMEM		(-1)
+#define	CXA_INVALID_NAME	(-2)
+#define	CXA_INVALID_ARGS	(-3)
+
+char *__cxa_demangle(const char *, char *, size_t *, int *);
+
+/*
+ * Each thread demangles with its own db, created on first use and destroyed
+ * when the thread exits, so the memory of one call is reused by the next.
+ */
+static pthread_once_t cxa_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cxa_key;
+static boolean_t cxa_key_ok;
+
+static void
+cxa_db_free(void *db)
+{
+	cpp_db_destroy(db);
+}
+
+static void
+cxa_init(void)
+{
+	if (pthread_key_create(&cxa_key, cxa_db_free) == 0)
+		cxa_key_ok = B_TRUE;
+}
+
+static struct cpp_db_s *
+cxa_db(void)
+{
+	struct cpp_db_s *db;
+
+	(void) pthread_once(&cxa_once, cxa_init);
+	if (!cxa_key_ok)
+		return (NULL);
+
+	if ((db = pthread_getspecific(cxa_key)) != NULL)
+		return (db);
+
+	if ((db = cpp_db_create(sysdem_ops_default)) == NULL)
+		return (NULL);
+
+	if (pthread_setspecific(cxa_key, db) != 0) {
+		cpp_db_destroy(db);
+		return (NULL);
+	}
+
+	return (db);
+}
+
+static char *
+cxa_fail(int *status, int code)
+{
+	if (status != NULL)
+		*status = code;
+	return (NULL);
+}
+
+char *
+__cxa_demangle(const char *mangled, char *buf, size_t *n, int *status)
+{
+	struct cpp_db_s *db;
+	const char *res = NULL;
+	size_t len = 0;
+	size_t mlen;
+	int ret, err;
+
+	if (mangled == NULL || (buf != NULL && n == NULL))
+		return (cxa_fail(status, CXA_INVALID_ARGS));
+
+	mlen = strlen(mangled);
+	if (!cpp_is_mangled(mangled, mangled + mlen))
+		return (cxa_fail(status, CXA_INVALID_NAME));
+
+	if ((db = cxa_db()) == NULL)
+		return (cxa_fail(status, CXA_NOMEM));
+
+	/* callers of __cxa_demangle() do not expect errno to change */
+	err = errno;
+	ret = cpp_demangle_db_str(db, mangled, mlen, &res, &len);
+	errno = err;
+	if (ret != 0) {
+		return (cxa_fail(status,
+		    (ret == ENOMEM) ? CXA_NOMEM : CXA_INVALID_NAME));
+	}
+
+	/* the caller frees buf with free(), so it's always the libc heap */
+	if (buf == NULL || *n <= len) {
+		char *newbuf = realloc(buf, len + 1);
+
+		if (newbuf == NULL)
+			return (cxa_fail(status, CXA_NOMEM));
+
+		buf = newbuf;
+		if (n != NULL)
+			*n = len + 1;
+	}
+
+	(void) memcpy(buf, res, len);
+	buf[len] = '\0';
+
+	if (status != NULL)
+		*status = CXA_SUCCESS;
+	return (buf);
+}
@@ -16,11 +16,19 @@
 #include "str.h"
 #include "util.h"
 
+#ifndef STR_CHUNK_SZ
 #define STR_CHUNK_SZ	(64U)
+#endif
 
 /* are we storing a reference vs. a dynamically allocated copy? */
 #define IS_REF(s) ((s)->str_s != NULL && (s)->str_size == 0)
 
+/* are the contents in s->str_buf? */
+#define IS_INLINE(s) ((s)->str_s == NULL)
+
+/* is s an allocated buffer (which may have str_head bytes before str_s)? */
+#define IS_ALLOC(s) ((s)->str_s != NULL && (s)->str_size != 0)
+
 /*
  * Dynamically resizeable strings, with lazy allocation when initialized
  * with a constant string value
@@ -30,13 +38,27 @@
  * Additionally, these can store references instead of copies of strings
  * (as indicated by the IS_REF() macro.  However mutation may cause a
  * string to convert from a refence to a dynamically allocated copy.
+ *
+ * Copies of up to STR_SSO_SZ bytes are stored in the str_t itself
+ * (IS_INLINE()), so most of the short strings built while demangling
+ * never need an allocation.  Since those move with their str_t, nothing
+ * may keep a pointer to them (str_ref() copies them instead).
+ *
+ * Inserting into (or erasing from) an allocated string moves whichever
+ * side of the position is shorter.  When there is no space in front of
+ * the contents to move the front into, the string is copied to a new
+ * buffer with free space at both ends, so repeatedly prepending to a
+ * string takes amortized constant time just as appending does.
  */
 
+/* str_buf is only valid up to str_len, so it is never cleared */
 void
 str_init(str_t *restrict s, sysdem_ops_t *restrict ops)
 {
-	(void) memset(s, 0, sizeof (*s));
+	s->str_s = NULL;
 	s->str_ops = (ops != NULL) ? ops : sysdem_ops_default;
+	s->str_len = 0;
+	s->str_size = 0;
 }
 
 void
@@ -44,9 +66,14 @@ str_fini(str_t *s)
 {
 	if (s == NULL)
 		return;
-	if (!IS_REF(s))
-		xfree(s->str_ops, s->str_s, s->str_size);
-	(void) memset(s, 0, sizeof (*s));
+	if (IS_ALLOC(s)) {
+		xfree(s->str_ops, s->str_s - s->str_head,
+		    s->str_head + s->str_size);
+	}
+	s->str_s = NULL;
+	s->str_ops = NULL;
+	s->str_len = 0;
+	s->str_size = 0;
 }
 
 size_t
@@ -79,42 +106,101 @@ str_copy(const str_t *src, str_t *dest)
 	if (src->str_len == 0)
 		return (B_TRUE);
 
+	if (src->str_len <= STR_SSO_SZ) {
+		(void) memcpy(dest->str_buf, STR_DATA(src), src->str_len);
+		dest->str_len = src->str_len;
+		return (B_TRUE);
+	}
+
 	size_t len = roundup(src->str_len, STR_CHUNK_SZ);
-	dest->str_s = zalloc(src->str_ops, len);
+	dest->str_s = xalloc(src->str_ops, len);
 	if (dest->str_s == NULL)
 		return (B_FALSE);
 
-	(void) memcpy(dest->str_s, src->str_s, src->str_len);
+	(void) memcpy(dest->str_s, STR_DATA(src), src->str_len);
 	dest->str_len = src->str_len;
 	dest->str_size = len;
+	dest->str_head = 0;
 
 	return (B_TRUE);
 }
 
+/*
+ * Make dest share the contents of src without copying them.  If src owns
+ * its buffer, ownership moves to dest and src becomes a reference to it,
+ * so the next change to src makes a private copy.  dest must not be
+ * changed (or freed) while src may still refer to its contents.  Inline
+ * strings are just copied.
+ */
+void
+str_share(str_t *src, str_t *dest)
+{
+	str_fini(dest);
+	*dest = *src;
+
+	if (!IS_REF(src) && !IS_INLINE(src))
+		src->str_size = 0;
+}
+
+/*
+ * Make dest a reference to the contents of src (or a copy, if src is
+ * inline).  The same caveats as str_set() apply.
+ */
+void
+str_ref(const str_t *src, str_t *dest)
+{
+	if (IS_INLINE(src)) {
+		sysdem_ops_t *ops = dest->str_ops;
+
+		str_fini(dest);
+		*dest = *src;
+		dest->str_ops = ops;
+		return;
+	}
+
+	str_set(dest, src->str_s, src->str_len);
+}
+
 /*
  * ensure s has at least amt bytes free, resizing if necessary
  */
-static boolean_t
+boolean_t
 str_reserve(str_t *s, size_t amt)
 {
 	size_t newlen = s->str_len + amt;
 
-	if (s->str_len + amt <= s->str_size && amt > 0)
+	if (IS_INLINE(s) && newlen <= STR_SSO_SZ)
+		return (B_TRUE);
+
+	/* references always need to be copied (even if amt == 0) */
+	if (newlen <= s->str_size && !IS_REF(s))
+		return (B_TRUE);
+
+	if (IS_REF(s) && newlen <= STR_SSO_SZ) {
+		(void) memcpy(s->str_buf, s->str_s, s->str_len);
+		s->str_s = NULL;
 		return (B_TRUE);
+	}
 
-	size_t newsize = roundup(newlen, STR_CHUNK_SZ);
+	size_t newsize = grow_size(s->str_size, newlen, STR_CHUNK_SZ);
 	void *temp;
 
-	if (IS_REF(s)) {
-		temp = zalloc(s->str_ops, newsize);
+	if (IS_REF(s) || IS_INLINE(s)) {
+		temp = xalloc(s->str_ops, newsize);
 		if (temp == NULL)
 			return (B_FALSE);
 
-		(void) memcpy(temp, s->str_s, s->str_len);
+		(void) memcpy(temp, STR_DATA(s), s->str_len);
+		s->str_head = 0;
 	} else {
-		temp = xrealloc(s->str_ops, s->str_s, s->str_size, newsize);
+		size_t head = s->str_head;
+
+		temp = xrealloc_nz(s->str_ops, s->str_s - head,
+		    head + s->str_size, head + newsize);
 		if (temp == NULL)
 			return (B_FALSE);
+
+		temp = (char *)temp + head;
 	}
 
 	s->str_s = temp;
@@ -143,11 +229,11 @@ boolean_t
 str_append_str(str_t *dest, const str_t *src)
 {
 	/* empty string is a noop */
-	if (src->str_s == NULL || src->str_len == 0)
+	if (src->str_len == 0)
 		return (B_TRUE);
 
-	/* if src is a reference, we can just copy that */
-	if (dest->str_s == NULL && IS_REF(src)) {
+	/* if dest is empty and src is a reference, we can just copy that */
+	if (dest->str_len == 0 && dest->str_size == 0 && IS_REF(src)) {
 		*dest = *src;
 		return (B_TRUE);
 	}
@@ -155,7 +241,8 @@ str_append_str(str_t *dest, const str_t *src)
 	if (!str_reserve(dest, src->str_len))
 		return (B_FALSE);
 
-	(void) memcpy(dest->str_s + dest->str_len, src->str_s, src->str_len);
+	(void) memcpy(STR_DATA(dest) + dest->str_len, STR_DATA(src),
+	    src->str_len);
 	dest->str_len += src->str_len;
 	return (B_TRUE);
 }
@@ -166,7 +253,55 @@ str_append_c(str_t *s, int c)
 	if (!str_reserve(s, 1))
 		return (B_FALSE);
 
-	s->str_s[s->str_len++] = c;
+	STR_DATA(s)[s->str_len++] = c;
+	return (B_TRUE);
+}
+
+/*
+ * Open up amt bytes at idx in s (the contents of which are left to the
+ * caller to fill in).
+ */
+static boolean_t
+str_open(str_t *s, size_t idx, size_t amt)
+{
+	size_t len = s->str_len;
+	boolean_t front = (idx < len - idx) ? B_TRUE : B_FALSE;
+	char *p;
+
+	if (front && IS_ALLOC(s) && s->str_head >= amt) {
+		/* Unlike some programmers, *I* can read manpages. */
+		(void) memmove(s->str_s - amt, s->str_s, idx);
+		s->str_s -= amt;
+		s->str_head -= amt;
+		s->str_size += amt;
+	} else if (!front || (IS_INLINE(s) && len + amt <= STR_SSO_SZ)) {
+		if (!str_reserve(s, amt))
+			return (B_FALSE);
+
+		p = STR_DATA(s);
+		(void) memmove(p + idx + amt, p + idx, len - idx);
+	} else {
+		size_t oldsz = IS_ALLOC(s) ? s->str_head + s->str_size : 0;
+		size_t total = grow_size(oldsz, len + amt, STR_CHUNK_SZ);
+		size_t head = (total - len - amt) / 2;
+		char *temp = xalloc(s->str_ops, total);
+
+		if (temp == NULL)
+			return (B_FALSE);
+
+		p = STR_DATA(s);
+		(void) memcpy(temp + head, p, idx);
+		(void) memcpy(temp + head + idx + amt, p + idx, len - idx);
+
+		if (IS_ALLOC(s))
+			xfree(s->str_ops, s->str_s - s->str_head, oldsz);
+
+		s->str_s = temp + head;
+		s->str_head = head;
+		s->str_size = total - head;
+	}
+
+	s->str_len += amt;
 	return (B_TRUE);
 }
 
@@ -197,22 +332,13 @@ str_insert_str(str_t *dest, size_t idx, const str_t *src)
 	if (idx == dest->str_len)
 		return (str_append_str(dest, src));
 
-	if (idx == 0 && dest->str_s == NULL && IS_REF(src)) {
-		sysdem_ops_t *ops = dest->str_ops;
-		*dest = *src;
-		dest->str_ops = ops;
+	if (src->str_len == 0)
 		return (B_TRUE);
-	}
 
-	if (!str_reserve(dest, src->str_len))
+	if (!str_open(dest, idx, src->str_len))
 		return (B_FALSE);
 
-	/* Unlike some programmers, *I* can read manpages. */
-	(void) memmove(dest->str_s + idx + src->str_len, dest->str_s + idx,
-	    dest->str_len - idx);
-	(void) memcpy(dest->str_s + idx, src->str_s, src->str_len);
-	dest->str_len += src->str_len;
-
+	(void) memcpy(STR_DATA(dest) + idx, STR_DATA(src), src->str_len);
 	return (B_TRUE);
 }
 
@@ -225,7 +351,17 @@ str_erase(str_t *s, size_t pos, size_t len)
 			return (B_FALSE);
 	}
 
-	(void) memmove(s->str_s + pos, s->str_s + pos + len, s->str_len - len);
+	char *p = STR_DATA(s);
+
+	if (IS_ALLOC(s) && pos < s->str_len - pos - len) {
+		(void) memmove(p + len, p, pos);
+		s->str_s += len;
+		s->str_head += len;
+		s->str_size -= len;
+	} else {
+		(void) memmove(p + pos, p + pos + len, s->str_len - pos - len);
+	}
+
 	s->str_len -= len;
 	return (B_TRUE);
 }
@@ -233,7 +369,6 @@ str_erase(str_t *s, size_t pos, size_t len)
 str_pair_t *
 str_pair_init(str_pair_t *sp, sysdem_ops_t *ops)
 {
-	(void) memset(sp, 0, sizeof (*sp));
 	str_init(&sp->strp_l, ops);
 	str_init(&sp->strp_r, ops);
 	return (sp);
@@ -26,13 +26,32 @@ extern "C" {
 
 struct sysdem_alloc_s;
 
+/*
+ * Owned strings of up to STR_SSO_SZ bytes are kept in str_buf instead of
+ * an allocated buffer, in which case str_s is NULL.  Use STR_DATA() to
+ * get at the contents of a str_t.
+ *
+ * For an allocated buffer, str_size is the space available from str_s
+ * on, and str_head is the space free in front of str_s (which lets
+ * str_insert() prepend without moving the contents).
+ */
+#ifndef STR_SSO_SZ
+#define	STR_SSO_SZ	(16U)
+#endif
+
 typedef struct str_s {
 	char		*str_s;
 	sysdem_ops_t	*str_ops;
 	size_t		str_len;
 	size_t		str_size;
+	union {
+		char	str_buf[STR_SSO_SZ];
+		size_t	str_head;
+	};
 } str_t;
 
+#define	STR_DATA(s)	(((s)->str_s != NULL) ? (s)->str_s : (s)->str_buf)
+
 typedef struct str_pair_s {
 	str_t	strp_l;
 	str_t	strp_r;
@@ -42,7 +61,10 @@ void str_init(str_t *restrict, sysdem_ops_t *);
 void str_fini(str_t *);
 size_t str_length(const str_t *);
 boolean_t str_copy(const str_t *, str_t *);
+void str_share(str_t *, str_t *);
+void str_ref(const str_t *, str_t *);
 void str_set(str_t *, const char *, size_t);
+boolean_t str_reserve(str_t *, size_t);
 boolean_t str_append(str_t *, const char *, size_t);
 boolean_t str_append_str(str_t *, const str_t *);
 boolean_t str_append_c(str_t *, int);
@@ -18,12 +18,14 @@
 #include "sysdemangle.h"
 #include "sysdemangle_int.h"
 
+struct sysdem_ctx_s {
+	sysdem_ops_t	*ctx_ops;
+	struct cpp_db_s	*ctx_cpp;
+};
 
 static sysdem_lang_t
-detect_lang(const char *str)
+detect_lang(const char *str, size_t n)
 {
-	size_t n = strlen(str);
-
 	if (n < 3 || str[0] != '_')
 		return (SYSDEM_LANG_AUTO);
 
@@ -39,21 +41,56 @@ detect_lang(const char *str)
 	}
 
 	/* why they use ___Z sometimes is puzzling.. *sigh* */
-	if (str[2] == '_' && str[3] == 'Z')
+	if (n > 3 && str[2] == '_' && str[3] == 'Z')
 		return (SYSDEM_LANG_CPP);
 
 	return (SYSDEM_LANG_AUTO);
 }
 
+/*
+ * Only names starting with '_' are ever detected as mangled, and most
+ * symbols are plain C names, so those are rejected before taking the
+ * strlen() of them.
+ */
+#define	NOT_MANGLED(str, lang)	((lang) == SYSDEM_LANG_AUTO && (str)[0] != '_')
+
+sysdem_lang_t
+sysdemangle_is_mangled(const char *str, size_t len)
+{
+	switch (detect_lang(str, len)) {
+	case SYSDEM_LANG_CPP:
+		if (cpp_is_mangled(str, str + len))
+			return (SYSDEM_LANG_CPP);
+		break;
+
+	default:
+		break;
+	}
+
+	return (SYSDEM_LANG_AUTO);
+}
+
 char *
 sysdemangle(const char *str, sysdem_lang_t lang, sysdem_ops_t *ops)
+{
+	if (NOT_MANGLED(str, lang)) {
+		errno = ENOSYS;
+		return (NULL);
+	}
+
+	return (sysdemangle_n(str, strlen(str), lang, ops));
+}
+
+char *
+sysdemangle_n(const char *str, size_t len, sysdem_lang_t lang,
+    sysdem_ops_t *ops)
 {
 
 	if (ops == NULL)
 		ops = sysdem_ops_default;
 
 	if (lang == SYSDEM_LANG_AUTO) {
-		lang = detect_lang(str);
+		lang = detect_lang(str, len);
 		if (lang == SYSDEM_LANG_AUTO) {
 			errno = ENOSYS;
 			return (NULL);
@@ -62,7 +99,11 @@ sysdemangle(const char *str, sysdem_lang_t lang, sysdem_ops_t *ops)
 
 	switch (lang) {
 	case SYSDEM_LANG_CPP:
-		return (cpp_demangle(str, ops));
+		if (!cpp_is_mangled(str, str + len)) {
+			errno = EINVAL;
+			return (NULL);
+		}
+		return (cpp_demangle(str, len, ops));
 
 	default:
 		break;
@@ -73,3 +114,306 @@ sysdemangle(const char *str, sysdem_lang_t lang, sysdem_ops_t *ops)
 	return (NULL);
 }
 
+int
+sysdemangle_r(const char *str, sysdem_lang_t lang, char *buf, size_t *lenp,
+    sysdem_ops_t *ops)
+{
+	if (lenp == NULL)
+		return (EINVAL);
+
+	if (NOT_MANGLED(str, lang))
+		return (ENOSYS);
+
+	return (sysdemangle_n_r(str, strlen(str), lang, buf, lenp, ops));
+}
+
+int
+sysdemangle_n_r(const char *str, size_t len, sysdem_lang_t lang, char *buf,
+    size_t *lenp, sysdem_ops_t *ops)
+{
+	if (lenp == NULL)
+		return (EINVAL);
+
+	if (ops == NULL)
+		ops = sysdem_ops_default;
+
+	if (lang == SYSDEM_LANG_AUTO) {
+		lang = detect_lang(str, len);
+		if (lang == SYSDEM_LANG_AUTO)
+			return (ENOSYS);
+	}
+
+	switch (lang) {
+	case SYSDEM_LANG_CPP:
+		if (!cpp_is_mangled(str, str + len))
+			return (EINVAL);
+		return (cpp_demangle_r(str, len, buf, lenp, ops));
+
+	default:
+		break;
+	}
+
+	return (ENOSYS);
+}
+
+sysdem_ctx_t *
+sysdem_ctx_create(sysdem_ops_t *ops)
+{
+	sysdem_ctx_t *ctx;
+
+	if (ops == NULL)
+		ops = sysdem_ops_default;
+
+	if ((ctx = zalloc(ops, sizeof (*ctx))) == NULL)
+		return (NULL);
+
+	ctx->ctx_ops = ops;
+	return (ctx);
+}
+
+void
+sysdem_ctx_destroy(sysdem_ctx_t *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	cpp_db_destroy(ctx->ctx_cpp);
+	xfree(ctx->ctx_ops, ctx, sizeof (*ctx));
+}
+
+void
+sysdem_ctx_stats(const sysdem_ctx_t *ctx, sysdem_stats_t *stats)
+{
+	(void) memset(stats, 0, sizeof (*stats));
+
+	if (ctx->ctx_cpp != NULL)
+		cpp_db_stats(ctx->ctx_cpp, stats);
+}
+
+/* The per-language state is created on first use */
+static struct cpp_db_s *
+ctx_cpp(sysdem_ctx_t *ctx)
+{
+	if (ctx->ctx_cpp == NULL)
+		ctx->ctx_cpp = cpp_db_create(ctx->ctx_ops);
+	return (ctx->ctx_cpp);
+}
+
+/*
+ * Demangle str into storage owned by ctx.  On success, *resp and *lenp are
+ * set to the (non NUL-terminated) result, which is valid until ctx is next
+ * used.
+ */
+static int
+ctx_demangle(sysdem_ctx_t *ctx, const char *str, size_t len,
+    sysdem_lang_t lang, const char **resp, size_t *lenp)
+{
+	struct cpp_db_s *db;
+
+	if (lang == SYSDEM_LANG_AUTO) {
+		lang = detect_lang(str, len);
+		if (lang == SYSDEM_LANG_AUTO)
+			return (ENOSYS);
+	}
+
+	switch (lang) {
+	case SYSDEM_LANG_CPP:
+		if (!cpp_is_mangled(str, str + len))
+			return (EINVAL);
+		if ((db = ctx_cpp(ctx)) == NULL)
+			return (ENOMEM);
+		return (cpp_demangle_db_str(db, str, len, resp, lenp));
+
+	default:
+		break;
+	}
+
+	return (ENOSYS);
+}
+
+char *
+sysdemangle_ctx(sysdem_ctx_t *ctx, const char *str, size_t len,
+    sysdem_lang_t lang)
+{
+	const char *s = NULL;
+	char *result;
+	size_t slen = 0;
+	int ret;
+
+	if ((ret = ctx_demangle(ctx, str, len, lang, &s, &slen)) != 0) {
+		errno = ret;
+		return (NULL);
+	}
+
+	if ((result = xalloc(result_ops(ctx->ctx_ops), slen + 1)) == NULL) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	(void) memcpy(result, s, slen);
+	result[slen] = '\0';
+	return (result);
+}
+
+int
+sysdemangle_ctx_r(sysdem_ctx_t *ctx, const char *str, size_t len,
+    sysdem_lang_t lang, char *buf, size_t *lenp)
+{
+	const char *s = NULL;
+	size_t slen = 0;
+	int ret;
+
+	if (lenp == NULL)
+		return (EINVAL);
+
+	if ((ret = ctx_demangle(ctx, str, len, lang, &s, &slen)) != 0)
+		return (ret);
+
+	if (buf == NULL || *lenp <= slen) {
+		*lenp = slen + 1;
+		return (ERANGE);
+	}
+
+	(void) memcpy(buf, s, slen);
+	buf[slen] = '\0';
+	*lenp = slen + 1;
+	return (0);
+}
+
+/*
+ * Demangled C++ names are usually two to three times the length of the
+ * mangled name, so that is used to size the initial output region when
+ * we allocate it.
+ */
+#define	BATCH_SIZE_FACTOR	(3U)
+
+int
+sysdemangle_batch(sysdem_ctx_t *ctx, const sysdem_sym_t *syms,
+    sysdem_res_t *res, size_t n, sysdem_lang_t lang, char **bufp,
+    size_t *lenp)
+{
+	sysdem_ctx_t *tmp = NULL;
+	sysdem_ops_t *ops;
+	char *buf;
+	size_t bufsz, need, off = 0;
+	boolean_t alloced = B_FALSE;
+	int ret = 0;
+
+	if ((n > 0 && (syms == NULL || res == NULL)) || bufp == NULL ||
+	    lenp == NULL)
+		return (EINVAL);
+
+	if (ctx == NULL) {
+		if ((tmp = sysdem_ctx_create(NULL)) == NULL)
+			return (ENOMEM);
+		ctx = tmp;
+	}
+	ops = result_ops(ctx->ctx_ops);
+
+	buf = *bufp;
+	bufsz = (buf != NULL) ? *lenp : 0;
+
+	if (buf == NULL && n > 0) {
+		for (size_t i = 0; i < n; i++)
+			bufsz += syms[i].ss_len + 1;
+		bufsz *= BATCH_SIZE_FACTOR;
+
+		/* on failure, the loop below still fills in every res[i] */
+		if ((buf = xalloc(ops, bufsz)) == NULL) {
+			bufsz = 0;
+			ret = ENOMEM;
+		}
+		alloced = B_TRUE;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		const char *s = NULL;
+		size_t len = 0;
+
+		res[i].sr_str = NULL;
+		res[i].sr_len = 0;
+
+		/* the region is lost, so there's no point demangling the rest */
+		if (ret == ENOMEM) {
+			res[i].sr_err = ENOMEM;
+			continue;
+		}
+
+		res[i].sr_err = ctx_demangle(ctx, syms[i].ss_str,
+		    syms[i].ss_len, lang, &s, &len);
+
+		if (res[i].sr_err != 0)
+			continue;
+
+		res[i].sr_len = len;
+
+		if (ret == 0 && bufsz - off <= len && alloced) {
+			size_t newsz = bufsz * 2;
+			char *temp;
+
+			while (newsz - off <= len)
+				newsz *= 2;
+
+			temp = xrealloc_nz(ops, buf, bufsz, newsz);
+			if (temp == NULL) {
+				ret = ENOMEM;
+				res[i].sr_err = ENOMEM;
+				res[i].sr_len = 0;
+				continue;
+			}
+			buf = temp;
+			bufsz = newsz;
+		}
+
+		if (ret == 0 && bufsz - off <= len)
+			ret = ERANGE;
+
+		if (ret != 0) {
+			/* keep going to compute the total size needed */
+			res[i].sr_err = ERANGE;
+			off += len + 1;
+			continue;
+		}
+
+		(void) memcpy(buf + off, s, len);
+		buf[off + len] = '\0';
+		off += len + 1;
+	}
+
+	sysdem_ctx_destroy(tmp);
+	need = off;
+
+	if (ret == ENOMEM) {
+		/* the names demangled before the failure went with the region */
+		for (size_t i = 0; i < n; i++) {
+			if (res[i].sr_err == 0) {
+				res[i].sr_err = ENOMEM;
+				res[i].sr_len = 0;
+			}
+		}
+		xfree(ops, buf, bufsz);
+		return (ret);
+	}
+
+	/*
+	 * Now that the region won't move any more, point the results at
+	 * their names.  They were packed in order, so the offset of each is
+	 * just the sum of the sizes of the ones before it.
+	 */
+	off = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (res[i].sr_err != 0)
+			continue;
+
+		res[i].sr_str = buf + off;
+		off += res[i].sr_len + 1;
+	}
+
+	if (ret == ERANGE)
+		*lenp = need;
+	else
+		*lenp = bufsz;
+
+	*bufp = buf;
+	return (ret);
+}
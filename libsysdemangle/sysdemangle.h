@@ -17,6 +17,7 @@
 #define	_SYSDEMANGLE_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,9 +32,186 @@ typedef struct sysdem_alloc_s {
 	void *(*alloc)(size_t);
 	void (*free)(void *, size_t);
 } sysdem_ops_t;
-	
+
+/*
+ * Extended allocator ops.  Adds a context argument passed to each
+ * callback, and an optional realloc callback used to grow blocks (which
+ * must preserve the first oldsz bytes; p is NULL when oldsz is 0).
+ * Initialize ops to SYSDEM_OPS_EXT and pass &ext.ops wherever a
+ * sysdem_ops_t is expected.
+ */
+typedef struct sysdem_ops_ext_s {
+	sysdem_ops_t	ops;
+	void		*arg;
+	void		*(*alloc)(void *, size_t);
+	void		(*free)(void *, void *, size_t);
+	void		*(*realloc)(void *, void *, size_t, size_t);
+} sysdem_ops_ext_t;
+
+void *sysdem_ops_ext_alloc(size_t);
+void sysdem_ops_ext_free(void *, size_t);
+
+#define	SYSDEM_OPS_EXT	{ sysdem_ops_ext_alloc, sysdem_ops_ext_free }
+
 char *sysdemangle(const char *, sysdem_lang_t, sysdem_ops_t *);
 
+/*
+ * Reentrant variant of sysdemangle() that writes the demangled name into a
+ * caller supplied buffer.  On entry *lenp is the size of buf; on a
+ * successful parse it is set to the size required to hold the result
+ * (including the terminating NUL).  Returns 0 on success, ERANGE if buf
+ * is too small, or another errno value on failure.  ops is only used for
+ * the demangler's internal allocations.
+ */
+int sysdemangle_r(const char *, sysdem_lang_t, char *, size_t *,
+    sysdem_ops_t *);
+
+/*
+ * Variants of the above that take the length of the mangled name instead
+ * of requiring it to be NUL-terminated.  Nothing past str[len - 1] is
+ * ever read.
+ */
+char *sysdemangle_n(const char *, size_t, sysdem_lang_t, sysdem_ops_t *);
+int sysdemangle_n_r(const char *, size_t, sysdem_lang_t, char *, size_t *,
+    sysdem_ops_t *);
+
+/*
+ * A quick check, done without allocating anything, of whether the len
+ * bytes at str look like a mangled name.  Returns the language the name
+ * appears to be mangled with, or SYSDEM_LANG_AUTO (which is 0) if it is not
+ * a mangled name.  Only the start of the name is examined, so a name can be
+ * accepted here and still fail to demangle; but one that is rejected would
+ * also be rejected by sysdemangle_n() with SYSDEM_LANG_AUTO.
+ */
+sysdem_lang_t sysdemangle_is_mangled(const char *, size_t);
+
+/*
+ * A demangling context.  Each call through a context reuses the memory the
+ * demangler allocated for its internal state on previous calls, so after
+ * warming up, demangling with a context allocates little more than the
+ * result.  A context may only be used by one thread at a time.
+ *
+ * sysdemangle_ctx() and sysdemangle_ctx_r() behave like sysdemangle_n() and
+ * sysdemangle_n_r() respectively, using the ops given to sysdem_ctx_create()
+ * for all allocations (including the string returned by sysdemangle_ctx()).
+ */
+typedef struct sysdem_ctx_s sysdem_ctx_t;
+
+sysdem_ctx_t *sysdem_ctx_create(sysdem_ops_t *);
+void sysdem_ctx_destroy(sysdem_ctx_t *);
+char *sysdemangle_ctx(sysdem_ctx_t *, const char *, size_t, sysdem_lang_t);
+int sysdemangle_ctx_r(sysdem_ctx_t *, const char *, size_t, sysdem_lang_t,
+    char *, size_t *);
+
+/*
+ * Counters describing the work done by a context since it was created.
+ * st_fwd_refs counts names that refer to template parameters before the
+ * arguments for them have been parsed (e.g. templated conversion
+ * operators).  Those are resolved once the arguments are known; the ones
+ * that cannot be resolved that way are parsed a second time and counted
+ * in st_reparsed.
+ */
+typedef struct sysdem_stats_s {
+	uint64_t	st_names;
+	uint64_t	st_fwd_refs;
+	uint64_t	st_reparsed;
+} sysdem_stats_t;
+
+void sysdem_ctx_stats(const sysdem_ctx_t *, sysdem_stats_t *);
+
+/*
+ * Demangle an array of symbols in one call.  syms[i] is demangled into
+ * res[i].  All of the demangled names are packed one after another (each
+ * NUL-terminated) into a single output region, and res[i].sr_str points
+ * into it.  If a symbol cannot be demangled, res[i].sr_str is NULL and
+ * res[i].sr_err contains the reason.
+ *
+ * If *bufp is NULL on entry, the region is allocated using the ctx's ops,
+ * and on return *bufp and *lenp are set to the region and its size (which
+ * should be passed to the ops' free function when done).  Otherwise *bufp
+ * is a caller supplied buffer of *lenp bytes.  If it is not large enough,
+ * the results that fit are filled in, the remaining successfully demangled
+ * symbols get ERANGE, *lenp is set to the size needed for the whole batch,
+ * and ERANGE is returned.  If the region can't be grown, ENOMEM is
+ * returned, nothing is allocated, and every res[i] without an error of its
+ * own gets ENOMEM.
+ *
+ * ctx may be NULL, in which case a temporary context using the default
+ * ops is used.  Returns 0 on success or an errno value.
+ */
+typedef struct sysdem_sym_s {
+	const char	*ss_str;
+	size_t		ss_len;
+} sysdem_sym_t;
+
+typedef struct sysdem_res_s {
+	const char	*sr_str;
+	size_t		sr_len;
+	int		sr_err;
+} sysdem_res_t;
+
+int sysdemangle_batch(sysdem_ctx_t *, const sysdem_sym_t *, sysdem_res_t *,
+    size_t, sysdem_lang_t, char **, size_t *);
+
+/*
+ * An arena allocator for use as the ops of any of the functions above.
+ * Memory is handed out from large chunks (of chunksz bytes, or a default
+ * size if 0) obtained from the backing ops, freeing is a no-op, and
+ * sysdem_arena_reset() releases everything allocated from the arena at
+ * once while keeping the chunks for reuse.
+ *
+ * Demangled names returned to the caller (by sysdemangle(),
+ * sysdemangle_ctx(), and the region allocated by sysdemangle_batch()) are
+ * not allocated from the arena but from its backing ops, so they outlive a
+ * reset and must be freed with the backing ops.  A sysdem_ctx_t created
+ * with an arena's ops lives in the arena, so the arena must not be reset
+ * until the context is destroyed.
+ *
+ * The ops returned by sysdem_arena_ops() are only usable by this library.
+ */
+typedef struct sysdem_arena_s sysdem_arena_t;
+
+sysdem_arena_t *sysdem_arena_create(sysdem_ops_t *, size_t);
+void sysdem_arena_destroy(sysdem_arena_t *);
+void sysdem_arena_reset(sysdem_arena_t *);
+sysdem_ops_t *sysdem_arena_ops(sysdem_arena_t *);
+
+/*
+ * A thread-safe cache of demangled names for callers that demangle the same
+ * names over and over.  It is keyed by the mangled name and the language
+ * passed in, and holds up to budget bytes (or a default size if 0) of
+ * names, evicting the least recently used ones to make room.  The cache is
+ * split into nshards (rounded up to a power of two, or a default number if
+ * 0) independently locked shards, each with an equal share of the budget,
+ * so lookups from different threads rarely contend.
+ *
+ * sysdemangle_cache() and sysdemangle_cache_r() behave like sysdemangle_ctx()
+ * and sysdemangle_ctx_r(); names that fail to demangle are not cached.  All
+ * memory, including the strings returned by sysdemangle_cache(), comes from
+ * the ops given to sysdem_cache_create(), which must be safe to call from
+ * any thread using the cache (so an arena's ops cannot be used).
+ *
+ * sysdem_cache_stats() returns the counters summed over all the shards.
+ * cs_bytes is the memory used by the cached names and the cache's hash
+ * tables, which is what is held to the budget.
+ */
+typedef struct sysdem_cache_s sysdem_cache_t;
+
+typedef struct sysdem_cache_stats_s {
+	uint64_t	cs_hits;
+	uint64_t	cs_misses;
+	uint64_t	cs_evictions;
+	size_t		cs_entries;
+	size_t		cs_bytes;
+} sysdem_cache_stats_t;
+
+sysdem_cache_t *sysdem_cache_create(sysdem_ops_t *, size_t, size_t);
+void sysdem_cache_destroy(sysdem_cache_t *);
+char *sysdemangle_cache(sysdem_cache_t *, const char *, size_t, sysdem_lang_t);
+int sysdemangle_cache_r(sysdem_cache_t *, const char *, size_t, sysdem_lang_t,
+    char *, size_t *);
+void sysdem_cache_stats(sysdem_cache_t *, sysdem_cache_stats_t *);
+
 #ifdef __cplusplus
 }
 #endif
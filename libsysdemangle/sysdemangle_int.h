@@ -58,14 +58,41 @@ typedef enum {
 
 #endif /* __sun */
 
+/*
+ * Growth policy for the library's dynamic arrays and strings.  When one
+ * needs to grow, its capacity is increased by SYSDEM_GROWTH_PCT percent
+ * (or to what is required if that is larger) so that building up large
+ * names takes amortized linear time.  It can be overridden at build
+ * time.
+ */
+#ifndef SYSDEM_GROWTH_PCT
+#define	SYSDEM_GROWTH_PCT	100
+#endif
 
 extern sysdem_ops_t *sysdem_ops_default;
 
-char *cpp_demangle(const char *, sysdem_ops_t *);
+struct cpp_db_s;
+
+char *cpp_demangle(const char *, size_t, sysdem_ops_t *);
+int cpp_demangle_r(const char *, size_t, char *, size_t *, sysdem_ops_t *);
+boolean_t cpp_is_mangled(const char *, const char *);
+
+struct cpp_db_s *cpp_db_create(sysdem_ops_t *);
+void cpp_db_destroy(struct cpp_db_s *);
+int cpp_demangle_db_str(struct cpp_db_s *, const char *, size_t,
+    const char **, size_t *);
+char *cpp_demangle_db(struct cpp_db_s *, const char *, size_t);
+int cpp_demangle_db_r(struct cpp_db_s *, const char *, size_t, char *,
+    size_t *);
+void cpp_db_stats(const struct cpp_db_s *, sysdem_stats_t *);
 
+void *xalloc(sysdem_ops_t *, size_t);
 void *zalloc(sysdem_ops_t *, size_t);
 void *xrealloc(sysdem_ops_t *, void *, size_t, size_t);
+void *xrealloc_nz(sysdem_ops_t *, void *, size_t, size_t);
 void xfree(sysdem_ops_t *, void *, size_t);
+sysdem_ops_t *result_ops(sysdem_ops_t *);
+size_t grow_size(size_t, size_t, size_t);
 
 #ifdef __cplusplus
 }
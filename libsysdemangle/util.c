@@ -13,15 +13,258 @@
  * Copyright 2017 Jason King
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include "sysdemangle.h"
 #include "sysdemangle_int.h"
 
+/*
+ * Extended ops (sysdem_ops_ext_t) are recognized by the marker functions
+ * in their embedded sysdem_ops_t.  The markers themselves are never
+ * called by the library, and always fail if called by anyone else.
+ */
+/*ARGSUSED*/
+void *
+sysdem_ops_ext_alloc(size_t len)
+{
+	errno = ENOTSUP;
+	return (NULL);
+}
+
+/*ARGSUSED*/
+void
+sysdem_ops_ext_free(void *p, size_t len)
+{
+}
+
+static inline sysdem_ops_ext_t *
+ops_ext(sysdem_ops_t *ops)
+{
+	if (ops->alloc != sysdem_ops_ext_alloc)
+		return (NULL);
+	return ((sysdem_ops_ext_t *)ops);
+}
+
+static void *
+ops_alloc(sysdem_ops_t *ops, size_t len)
+{
+	sysdem_ops_ext_t *ext = ops_ext(ops);
+
+	if (ext != NULL)
+		return (ext->alloc(ext->arg, len));
+	return (ops->alloc(len));
+}
+
+static void
+ops_free(sysdem_ops_t *ops, void *p, size_t len)
+{
+	sysdem_ops_ext_t *ext = ops_ext(ops);
+
+	if (ext != NULL)
+		ext->free(ext->arg, p, len);
+	else
+		ops->free(p, len);
+}
+
+/*
+ * An arena hands out memory from a list of large chunks.  Freeing memory
+ * is a no-op, and sysdem_arena_reset() just rewinds to the start of the
+ * first chunk, so the chunks are reused by the next round of allocations
+ * instead of being returned to the backing allocator.
+ */
+#define	ARENA_ALIGN	(16U)
+#define	ARENA_CHUNK_SZ	(64U * 1024U)
+
+typedef struct arena_chunk_s {
+	struct arena_chunk_s	*ac_next;
+	size_t			ac_size;
+	char			*ac_data;
+} arena_chunk_t;
+
+struct sysdem_arena_s {
+	sysdem_ops_ext_t sa_ops;
+	sysdem_ops_t	*sa_backing;
+	arena_chunk_t	*sa_first;
+	arena_chunk_t	*sa_cur;
+	size_t		sa_off;		/* offset of free space in sa_cur */
+	size_t		sa_chunksz;
+};
+
+#define	ARENA_HDR_SZ	roundup(sizeof (arena_chunk_t), ARENA_ALIGN)
+
+static arena_chunk_t *
+arena_chunk_new(sysdem_arena_t *a, size_t len)
+{
+	size_t size = (len > a->sa_chunksz) ? len : a->sa_chunksz;
+	arena_chunk_t *ac = ops_alloc(a->sa_backing, ARENA_HDR_SZ + size);
+
+	if (ac == NULL)
+		return (NULL);
+
+	ac->ac_next = NULL;
+	ac->ac_size = size;
+	ac->ac_data = (char *)ac + ARENA_HDR_SZ;
+	return (ac);
+}
+
+static void *
+arena_alloc(void *arg, size_t len)
+{
+	sysdem_arena_t *a = arg;
+	arena_chunk_t *ac = a->sa_cur;
+
+	len = roundup(len, ARENA_ALIGN);
+
+	if (ac != NULL && ac->ac_size - a->sa_off >= len) {
+		void *p = ac->ac_data + a->sa_off;
+
+		a->sa_off += len;
+		return (p);
+	}
+
+	/*
+	 * Move on to the next chunk left over from before the last reset if
+	 * it is big enough, otherwise allocate a new one and link it in after
+	 * the current chunk.
+	 */
+	if (ac != NULL && ac->ac_next != NULL && ac->ac_next->ac_size >= len) {
+		ac = ac->ac_next;
+	} else {
+		arena_chunk_t *nac = arena_chunk_new(a, len);
+
+		if (nac == NULL)
+			return (NULL);
+
+		if (ac == NULL) {
+			nac->ac_next = a->sa_first;
+			a->sa_first = nac;
+		} else {
+			nac->ac_next = ac->ac_next;
+			ac->ac_next = nac;
+		}
+		ac = nac;
+	}
+
+	a->sa_cur = ac;
+	a->sa_off = len;
+	return (ac->ac_data);
+}
+
+/*ARGSUSED*/
+static void
+arena_free(void *arg, void *p, size_t len)
+{
+}
+
+/*
+ * Growing the most recent allocation (the common case when appending to a
+ * string) can be done in place if there's room left in the chunk.
+ */
+static void *
+arena_realloc(void *arg, void *p, size_t oldsz, size_t newsz)
+{
+	sysdem_arena_t *a = arg;
+	arena_chunk_t *ac = a->sa_cur;
+
+	if (p != NULL && ac != NULL &&
+	    (char *)p + roundup(oldsz, ARENA_ALIGN) == ac->ac_data + a->sa_off &&
+	    (char *)p - ac->ac_data + newsz <= ac->ac_size) {
+		a->sa_off = roundup((char *)p - ac->ac_data + newsz,
+		    ARENA_ALIGN);
+		return (p);
+	}
+
+	void *temp = arena_alloc(a, newsz);
+
+	if (temp != NULL && oldsz > 0)
+		(void) memcpy(temp, p, oldsz);
+
+	return (temp);
+}
+
+sysdem_arena_t *
+sysdem_arena_create(sysdem_ops_t *backing, size_t chunksz)
+{
+	sysdem_arena_t *a;
+
+	if (backing == NULL)
+		backing = sysdem_ops_default;
+
+	if ((a = ops_alloc(backing, sizeof (*a))) == NULL)
+		return (NULL);
+
+	(void) memset(a, 0, sizeof (*a));
+	a->sa_ops.ops = (sysdem_ops_t)SYSDEM_OPS_EXT;
+	a->sa_ops.arg = a;
+	a->sa_ops.alloc = arena_alloc;
+	a->sa_ops.free = arena_free;
+	a->sa_ops.realloc = arena_realloc;
+	a->sa_backing = backing;
+	a->sa_chunksz = (chunksz > 0) ? chunksz : ARENA_CHUNK_SZ;
+	return (a);
+}
+
+void
+sysdem_arena_destroy(sysdem_arena_t *a)
+{
+	if (a == NULL)
+		return;
+
+	arena_chunk_t *ac = a->sa_first;
+
+	while (ac != NULL) {
+		arena_chunk_t *next = ac->ac_next;
+
+		ops_free(a->sa_backing, ac, ARENA_HDR_SZ + ac->ac_size);
+		ac = next;
+	}
+
+	ops_free(a->sa_backing, a, sizeof (*a));
+}
+
+void
+sysdem_arena_reset(sysdem_arena_t *a)
+{
+	a->sa_cur = a->sa_first;
+	a->sa_off = 0;
+}
+
+sysdem_ops_t *
+sysdem_arena_ops(sysdem_arena_t *a)
+{
+	return (&a->sa_ops.ops);
+}
+
+/*
+ * The ops used to allocate strings that are returned to the caller.  For an
+ * arena, these come from the backing allocator so they outlive the arena.
+ */
+sysdem_ops_t *
+result_ops(sysdem_ops_t *ops)
+{
+	sysdem_ops_ext_t *ext = ops_ext(ops);
+
+	if (ext != NULL && ext->alloc == arena_alloc)
+		return (((sysdem_arena_t *)ext->arg)->sa_backing);
+	return (ops);
+}
+
+/*
+ * Allocate len bytes without zeroing them.  For buffers whose contents are
+ * about to be overwritten; use zalloc() when the code relies on unused
+ * parts being zero.
+ */
+void *
+xalloc(sysdem_ops_t *ops, size_t len)
+{
+	return (ops_alloc(ops, len));
+}
+
 void *
 zalloc(sysdem_ops_t *ops, size_t len)
 {
-	void *p = ops->alloc(len);
+	void *p = ops_alloc(ops, len);
 
 	if (p != NULL)
 		(void) memset(p, 0, len);
@@ -35,18 +278,30 @@ xfree(sysdem_ops_t *ops, void *p, size_t len)
 	if (p == NULL || len == 0)
 		return;
 
-	ops->free(p, len);
+	ops_free(ops, p, len);
 }
 
+/*
+ * Grow p from oldsz to newsz bytes, preserving the contents.  If the ops
+ * have a realloc callback, it is used so the allocator can grow the block
+ * in place.  The new space is left uninitialized.
+ */
 void *
-xrealloc(sysdem_ops_t *ops, void *p, size_t oldsz, size_t newsz)
+xrealloc_nz(sysdem_ops_t *ops, void *p, size_t oldsz, size_t newsz)
 {
 	if (newsz == oldsz)
 		return (p);
 
 	ASSERT3U(newsz, >, oldsz);
 
-	void *temp = zalloc(ops, newsz);
+	sysdem_ops_ext_t *ext = ops_ext(ops);
+	void *temp;
+
+	if (ext != NULL && ext->realloc != NULL)
+		return (ext->realloc(ext->arg, (oldsz > 0) ? p : NULL, oldsz,
+		    newsz));
+
+	temp = ops_alloc(ops, newsz);
 
 	if (temp == NULL)
 		return (NULL);
@@ -55,18 +310,64 @@ xrealloc(sysdem_ops_t *ops, void *p, size_t oldsz, size_t newsz)
 		(void) memcpy(temp, p, oldsz);
 		xfree(ops, p, oldsz);
 	}
-	
+
+	return (temp);
+}
+
+/* Like xrealloc_nz(), but the new space is zero filled */
+void *
+xrealloc(sysdem_ops_t *ops, void *p, size_t oldsz, size_t newsz)
+{
+	void *temp = xrealloc_nz(ops, p, oldsz, newsz);
+
+	if (temp != NULL && newsz > oldsz)
+		(void) memset((char *)temp + oldsz, 0, newsz - oldsz);
+
 	return (temp);
 }
 
+/*
+ * Return the new capacity for something of size cursz that must grow to at
+ * least needed, rounded up to a multiple of chunk.
+ */
+size_t
+grow_size(size_t cursz, size_t needed, size_t chunk)
+{
+	size_t newsz = cursz + cursz / 100 * SYSDEM_GROWTH_PCT +
+	    cursz % 100 * SYSDEM_GROWTH_PCT / 100;
+
+	if (newsz < needed)
+		newsz = needed;
+
+	return (roundup(newsz, chunk));
+}
+
+/*ARGSUSED*/
+static void *
+def_alloc(void *arg, size_t len)
+{
+	return (malloc(len));
+}
+
 /*ARGSUSED*/
 static void
-def_free(void *p, size_t len)
+def_free(void *arg, void *p, size_t len)
 {
 	free(p);
 }
 
-sysdem_ops_t *sysdem_ops_default = &(sysdem_ops_t) {
-	.alloc = malloc,
-	.free = def_free
+/*ARGSUSED*/
+static void *
+def_realloc(void *arg, void *p, size_t oldsz, size_t newsz)
+{
+	return (realloc(p, newsz));
+}
+
+static sysdem_ops_ext_t def_ops = {
+	.ops = SYSDEM_OPS_EXT,
+	.alloc = def_alloc,
+	.free = def_free,
+	.realloc = def_realloc
 };
+
+sysdem_ops_t *sysdem_ops_default = &def_ops.ops;
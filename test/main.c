@@ -28,9 +28,29 @@ extern test_list_t *llvm_pass_list;
 extern test_fail_t *llvm_fail;
 extern test_fp_t *llvm_fp;
 
+char *__cxa_demangle(const char *, char *, size_t *, int *);
+
 static uint64_t total;
 static uint64_t success;
 
+/*
+ * Report that the i'th test t failed, either with err (if nonzero) or
+ * because it demangled to result instead.
+ */
+static void
+report(const test_t *t, size_t i, const char *result, int err)
+{
+	(void) printf("%zu failed:\n", i + 1);
+	(void) printf("      mangled name: %s\n", t->mangled);
+	(void) printf("  demangled result: ");
+	if (err == 0) {
+		(void) printf("%s\n", result);
+	} else {
+		(void) printf("error: %s\n", strerror(err));
+	}
+	(void) printf("          expected: %s\n", t->demangled);
+}
+
 static void
 run_test_list(test_list_t *tl)
 {
@@ -45,17 +65,378 @@ run_test_list(test_list_t *tl)
 
 		if (result == NULL ||
 		    strcmp(result, tl->tests[i].demangled) != 0) {
-			(void) printf("%zu failed:\n", i + 1);
-			(void) printf("      mangled name: %s\n",
-			    tl->tests[i].mangled);
-			(void) printf("  demangled result: ");
-			if (result != NULL) {
-				(void) printf("%s\n", result);
+			report(&tl->tests[i], i, result,
+			    (result != NULL) ? 0 : errno);
+		} else {
+			l_success++;
+		}
+
+		free(result);
+		l_total++;
+	}
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Same as run_test_list(), but use sysdemangle_r() with a deliberately
+ * undersized initial buffer so the ERANGE path is exercised as well.
+ */
+static void
+run_test_list_r(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	char *buf = NULL;
+	size_t bufsz = 0;
+
+	(void) printf("# Test: %s (sysdemangle_r)\n", tl->desc);
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		size_t len = bufsz;
+		int ret = sysdemangle_r(tl->tests[i].mangled, SYSDEM_LANG_CPP,
+		    buf, &len, NULL);
+
+		if (ret == ERANGE) {
+			char *nbuf = realloc(buf, len);
+
+			if (nbuf == NULL) {
+				(void) printf("out of memory\n");
+				break;
+			}
+			buf = nbuf;
+			bufsz = len;
+			ret = sysdemangle_r(tl->tests[i].mangled,
+			    SYSDEM_LANG_CPP, buf, &len, NULL);
+		}
+
+		if (ret != 0 || strcmp(buf, tl->tests[i].demangled) != 0 ||
+		    len != strlen(buf) + 1) {
+			report(&tl->tests[i], i, buf, ret);
+		} else {
+			l_success++;
+		}
+
+		l_total++;
+	}
+
+	free(buf);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Same as run_test_list(), but pass the mangled names to sysdemangle_n()
+ * with trailing junk after them to verify that only the given range is used.
+ */
+static void
+run_test_list_n(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+
+	(void) printf("# Test: %s (sysdemangle_n)\n", tl->desc);
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		size_t len = strlen(tl->tests[i].mangled);
+		char *buf = malloc(len + 4);
+
+		if (buf == NULL) {
+			(void) printf("out of memory\n");
+			break;
+		}
+
+		(void) memcpy(buf, tl->tests[i].mangled, len);
+		(void) memcpy(buf + len, "IiE", 4);
+
+		char *result = sysdemangle_n(buf, len, SYSDEM_LANG_CPP, NULL);
+
+		if (result == NULL ||
+		    strcmp(result, tl->tests[i].demangled) != 0) {
+			report(&tl->tests[i], i, result,
+			    (result != NULL) ? 0 : errno);
+		} else {
+			l_success++;
+		}
+
+		free(result);
+		free(buf);
+		l_total++;
+	}
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Run the list through a single sysdem_ctx_t, alternating between
+ * sysdemangle_ctx() and sysdemangle_ctx_r() so state left behind by either
+ * one is exercised by the other.
+ */
+static void
+run_test_list_ctx(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	sysdem_ctx_t *ctx = sysdem_ctx_create(NULL);
+	char buf[4096];
+
+	(void) printf("# Test: %s (sysdemangle_ctx)\n", tl->desc);
+
+	if (ctx == NULL) {
+		(void) printf("out of memory\n");
+		return;
+	}
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		const char *mangled = tl->tests[i].mangled;
+		char *result = NULL;
+		int ret = 0;
+
+		if (i % 2 == 0) {
+			result = sysdemangle_ctx(ctx, mangled, strlen(mangled),
+			    SYSDEM_LANG_CPP);
+			if (result == NULL)
+				ret = errno;
+		} else {
+			size_t len = sizeof (buf);
+
+			ret = sysdemangle_ctx_r(ctx, mangled, strlen(mangled),
+			    SYSDEM_LANG_CPP, buf, &len);
+		}
+
+		const char *res = (i % 2 == 0) ? result : buf;
+
+		if (ret != 0 || strcmp(res, tl->tests[i].demangled) != 0) {
+			report(&tl->tests[i], i, res, ret);
+		} else {
+			l_success++;
+		}
+
+		free(result);
+		l_total++;
+	}
+
+	sysdem_ctx_destroy(ctx);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Run the list through a sysdem_cache_t twice, alternating between
+ * sysdemangle_cache() and sysdemangle_cache_r().  With the default budget
+ * everything in the second pass should be a hit; with a small budget,
+ * entries should be evicted to keep within it.
+ */
+static void
+run_test_list_cache(test_list_t *tl, size_t budget)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	sysdem_cache_t *cache = sysdem_cache_create(NULL, budget, 4);
+	sysdem_cache_stats_t stats[2];
+	char buf[4096];
+
+	(void) printf("# Test: %s (sysdemangle_cache, budget %zu)\n",
+	    tl->desc, budget);
+
+	if (cache == NULL) {
+		(void) printf("out of memory\n");
+		return;
+	}
+
+	for (size_t pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < tl->ntests; i++) {
+			const char *mangled = tl->tests[i].mangled;
+			char *result = NULL;
+			int ret = 0;
+
+			if ((i + pass) % 2 == 0) {
+				result = sysdemangle_cache(cache, mangled,
+				    strlen(mangled), SYSDEM_LANG_CPP);
+				if (result == NULL)
+					ret = errno;
+			} else {
+				size_t len = sizeof (buf);
+
+				ret = sysdemangle_cache_r(cache, mangled,
+				    strlen(mangled), SYSDEM_LANG_CPP, buf,
+				    &len);
+			}
+
+			const char *res = ((i + pass) % 2 == 0) ? result : buf;
+
+			if (ret != 0 ||
+			    strcmp(res, tl->tests[i].demangled) != 0) {
+				report(&tl->tests[i], i, res, ret);
 			} else {
-				(void) printf("error: %s\n", strerror(errno));
+				l_success++;
 			}
-			(void) printf("          expected: %s\n",
-			    tl->tests[i].demangled);
+
+			free(result);
+			l_total++;
+		}
+
+		sysdem_cache_stats(cache, &stats[pass]);
+	}
+
+	l_total++;
+	if (stats[1].cs_hits + stats[1].cs_misses != 2 * tl->ntests) {
+		(void) printf("stats failed: %" PRIu64 " hits, %" PRIu64
+		    " misses\n", stats[1].cs_hits, stats[1].cs_misses);
+	} else if (budget == 0 && (stats[1].cs_misses != stats[0].cs_misses ||
+	    stats[1].cs_evictions != 0)) {
+		(void) printf("stats failed: %" PRIu64 " misses in second pass, "
+		    "%" PRIu64 " evictions\n",
+		    stats[1].cs_misses - stats[0].cs_misses,
+		    stats[1].cs_evictions);
+	} else if (budget != 0 && (stats[1].cs_evictions == 0 ||
+	    stats[1].cs_bytes > budget)) {
+		(void) printf("stats failed: %" PRIu64 " evictions, %zu bytes\n",
+		    stats[1].cs_evictions, stats[1].cs_bytes);
+	} else {
+		l_success++;
+	}
+
+	sysdem_cache_destroy(cache);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Demangle the whole list with one sysdemangle_batch() call, first into
+ * a buffer that is too small (checking the size reported back), then into
+ * a library allocated one.
+ */
+static void
+run_test_list_batch(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	sysdem_sym_t *syms = calloc(tl->ntests + 1, sizeof (sysdem_sym_t));
+	sysdem_res_t *res = calloc(tl->ntests + 1, sizeof (sysdem_res_t));
+	char small[16];
+	char *buf = small;
+	size_t len = sizeof (small);
+	size_t need = 0;
+	int ret;
+
+	(void) printf("# Test: %s (sysdemangle_batch)\n", tl->desc);
+
+	if (syms == NULL || res == NULL) {
+		(void) printf("out of memory\n");
+		goto done;
+	}
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		syms[i].ss_str = tl->tests[i].mangled;
+		syms[i].ss_len = strlen(tl->tests[i].mangled);
+		need += strlen(tl->tests[i].demangled) + 1;
+	}
+
+	ret = sysdemangle_batch(NULL, syms, res, tl->ntests, SYSDEM_LANG_CPP,
+	    &buf, &len);
+	if (tl->ntests > 0 && (ret != ERANGE || len != need)) {
+		(void) printf("short buffer: got %d/%zu, expected %d/%zu\n",
+		    ret, len, ERANGE, need);
+		l_total++;
+	}
+
+	buf = NULL;
+	ret = sysdemangle_batch(NULL, syms, res, tl->ntests, SYSDEM_LANG_CPP,
+	    &buf, &len);
+	if (ret != 0) {
+		(void) printf("sysdemangle_batch failed: %s\n", strerror(ret));
+		l_total++;
+		goto done;
+	}
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		if (res[i].sr_err != 0 ||
+		    strcmp(res[i].sr_str, tl->tests[i].demangled) != 0 ||
+		    res[i].sr_len != strlen(tl->tests[i].demangled)) {
+			report(&tl->tests[i], i, res[i].sr_str, res[i].sr_err);
+		} else {
+			l_success++;
+		}
+
+		l_total++;
+	}
+
+	free(buf);
+
+done:
+	free(syms);
+	free(res);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Demangle using an arena, resetting it after each name.  Odd entries are
+ * demangled with sysdemangle() to check the result outlives the reset.
+ */
+static void
+run_test_list_arena(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	sysdem_arena_t *arena = sysdem_arena_create(NULL, 0);
+	char buf[4096];
+
+	(void) printf("# Test: %s (sysdem_arena_t)\n", tl->desc);
+
+	if (arena == NULL) {
+		(void) printf("out of memory\n");
+		return;
+	}
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		const char *mangled = tl->tests[i].mangled;
+		char *result = NULL;
+		int ret = 0;
+
+		if (i % 2 == 0) {
+			size_t len = sizeof (buf);
+
+			ret = sysdemangle_r(mangled, SYSDEM_LANG_CPP, buf, &len,
+			    sysdem_arena_ops(arena));
+		} else {
+			result = sysdemangle(mangled, SYSDEM_LANG_CPP,
+			    sysdem_arena_ops(arena));
+			if (result == NULL)
+				ret = errno;
+		}
+
+		sysdem_arena_reset(arena);
+
+		const char *res = (i % 2 == 0) ? buf : result;
+
+		if (ret != 0 || strcmp(res, tl->tests[i].demangled) != 0) {
+			report(&tl->tests[i], i, res, ret);
 		} else {
 			l_success++;
 		}
@@ -64,6 +445,260 @@ run_test_list(test_list_t *tl)
 		l_total++;
 	}
 
+	sysdem_arena_destroy(arena);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Names with forward template references.  All but the last two are
+ * resolved without parsing the name a second time; the last two refer to
+ * function pointer types, which still need the second parse.
+ */
+static test_t fwd_tests[] = {
+	{ "_ZN1AcvT_IiEEv", "A::operator int<int>()" },
+	{ "_ZNK1AcvPT_IiEEv", "A::operator int*<int>() const" },
+	{ "_ZN1AcvT0_IicEEv", "A::operator char<int, char>()" },
+	{ "_ZN1AcvT_I1BIiEEEv", "A::operator B<int><B<int> >()" },
+	{ "_ZN1AcvSt6vectorIT_EI1BIiEEEv",
+	    "A::operator std::vector<B<int> ><B<int> >()" },
+	{ "_ZN1AcvT_IiEES1_", "A::operator int<int>(A::operator int)" },
+	{ "_ZN1AcvT_IPFivEEEv", "A::operator int (*)()<int (*)()>()" },
+	{ "_ZN1AcvPT_IPFivEEEv", "A::operator int (**)()<int (*)()>()" },
+};
+#define	FWD_NREPARSED	2
+
+static void
+run_test_fwd(void)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	size_t n = sizeof (fwd_tests) / sizeof (fwd_tests[0]);
+	sysdem_ctx_t *ctx = sysdem_ctx_create(NULL);
+	sysdem_stats_t stats;
+
+	(void) printf("# Test: forward template references\n");
+
+	if (ctx == NULL) {
+		(void) printf("out of memory\n");
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		const char *mangled = fwd_tests[i].mangled;
+		char *res = sysdemangle_ctx(ctx, mangled, strlen(mangled),
+		    SYSDEM_LANG_CPP);
+
+		if (res == NULL || strcmp(res, fwd_tests[i].demangled) != 0) {
+			report(&fwd_tests[i], i, res, (res != NULL) ? 0 : errno);
+		} else {
+			l_success++;
+		}
+
+		free(res);
+		l_total++;
+	}
+
+	sysdem_ctx_stats(ctx, &stats);
+	if (stats.st_names != n || stats.st_fwd_refs != n ||
+	    stats.st_reparsed != FWD_NREPARSED) {
+		(void) printf("stats failed: %" PRIu64 " names, %" PRIu64
+		    " forward refs, %" PRIu64 " reparsed\n", stats.st_names,
+		    stats.st_fwd_refs, stats.st_reparsed);
+	} else {
+		l_success++;
+	}
+	l_total++;
+
+	sysdem_ctx_destroy(ctx);
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Names that sysdemangle_is_mangled() should reject.  Every name in the
+ * test lists that demangles should be accepted.
+ */
+static const char *not_mangled[] = {
+	"main", "_start", "__libc_start_main", "_Z", "_Z1", "_Z0f", "_ZXv",
+	"__Z1fv", "___Z", "_ZL", "_ZLTv"
+};
+
+static void
+run_test_is_mangled(test_list_t **lists, size_t nlists)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+	size_t n = sizeof (not_mangled) / sizeof (not_mangled[0]);
+
+	(void) printf("# Test: sysdemangle_is_mangled()\n");
+
+	for (size_t i = 0; i < nlists; i++) {
+		for (size_t j = 0; j < lists[i]->ntests; j++) {
+			const char *mangled = lists[i]->tests[j].mangled;
+			size_t len = strlen(mangled);
+			char *res = sysdemangle_n(mangled, len,
+			    SYSDEM_LANG_AUTO, NULL);
+
+			l_total++;
+			if (res == NULL ||
+			    sysdemangle_is_mangled(mangled, len) ==
+			    SYSDEM_LANG_CPP) {
+				l_success++;
+			} else {
+				(void) printf("rejected: %s\n", mangled);
+			}
+			free(res);
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		const char *name = not_mangled[i];
+		char *res;
+
+		l_total++;
+		if (sysdemangle_is_mangled(name, strlen(name)) !=
+		    SYSDEM_LANG_AUTO) {
+			(void) printf("accepted: %s\n", name);
+			continue;
+		}
+
+		if ((res = sysdemangle(name, SYSDEM_LANG_AUTO, NULL)) != NULL) {
+			(void) printf("demangled: %s -> %s\n", name, res);
+			free(res);
+			continue;
+		}
+
+		l_success++;
+	}
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/*
+ * Run the list through the __cxa_demangle() shim, cycling between letting
+ * it allocate the result, handing it a buffer that is too small (which it
+ * must realloc()), and handing it one that is big enough.
+ */
+static void
+run_test_list_cxa(test_list_t *tl)
+{
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+
+	(void) printf("# Test: %s (__cxa_demangle)\n", tl->desc);
+
+	for (size_t i = 0; i < tl->ntests; i++) {
+		const char *mangled = tl->tests[i].mangled;
+		const char *demangled = tl->tests[i].demangled;
+		size_t explen = strlen(demangled) + 1;
+		char *buf = NULL;
+		char *res;
+		size_t n = 0;
+		int status = 1;
+		boolean_t ok;
+
+		switch (i % 3) {
+		case 1:
+			n = 1;
+			buf = malloc(n);
+			break;
+		case 2:
+			n = explen + 16;
+			buf = malloc(n);
+			break;
+		}
+
+		res = __cxa_demangle(mangled, buf, (i % 3 == 0) ? NULL : &n,
+		    &status);
+
+		ok = (res != NULL && status == 0 &&
+		    strcmp(res, demangled) == 0);
+		if (ok && i % 3 == 1)
+			ok = (n == explen);
+		if (ok && i % 3 == 2)
+			ok = (res == buf && n == explen + 16);
+
+		if (!ok) {
+			(void) printf("%zu failed:\n", i + 1);
+			(void) printf("      mangled name: %s\n", mangled);
+			(void) printf("  demangled result: %s (status %d)\n",
+			    (res != NULL) ? res : "NULL", status);
+			(void) printf("          expected: %s\n", demangled);
+		} else {
+			l_success++;
+		}
+
+		free((res != NULL) ? res : buf);
+		l_total++;
+	}
+
+	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
+	    l_success, l_total);
+
+	total += l_total;
+	success += l_success;
+}
+
+/* The failure cases of __cxa_demangle() and their status codes */
+static void
+run_test_cxa_status(void)
+{
+	static const struct {
+		const char	*mangled;
+		boolean_t	use_buf;
+		boolean_t	use_n;
+		int		status;
+	} cases[] = {
+		{ NULL, B_FALSE, B_FALSE, -3 },
+		{ "_Z1fv", B_TRUE, B_FALSE, -3 },
+		{ "", B_FALSE, B_FALSE, -2 },
+		{ "_Z", B_FALSE, B_FALSE, -2 },
+		{ "_Z1fI", B_TRUE, B_TRUE, -2 },
+		{ "_Zfoo", B_TRUE, B_TRUE, -2 },
+		{ "strlen", B_FALSE, B_TRUE, -2 },
+	};
+	uint64_t l_total = 0;
+	uint64_t l_success = 0;
+
+	(void) printf("# Test: __cxa_demangle() failures\n");
+
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		char *buf = cases[i].use_buf ? malloc(8) : NULL;
+		size_t n = 8;
+		int status = 1;
+		char *res;
+
+		res = __cxa_demangle(cases[i].mangled, buf,
+		    cases[i].use_n ? &n : NULL, &status);
+
+		if (res != NULL || status != cases[i].status || n != 8) {
+			(void) printf("%zu failed: %s -> %s (status %d)\n",
+			    i + 1, (cases[i].mangled != NULL) ?
+			    cases[i].mangled : "NULL",
+			    (res != NULL) ? res : "NULL", status);
+			if (res != buf)
+				free(res);
+		} else {
+			l_success++;
+		}
+
+		free(buf);
+		l_total++;
+	}
+
 	(void) printf("# Result: %" PRIu64 "/%" PRIu64 "\n\n",
 	    l_success, l_total);
 
@@ -152,6 +787,34 @@ main(int argc, const char * argv[]) {
 	run_test_list(gcc_libstdc);
 	run_test_list(llvm_pass_list);
 
+	run_test_list_r(gcc_libstdc);
+	run_test_list_r(llvm_pass_list);
+
+	run_test_list_n(gcc_libstdc);
+	run_test_list_n(llvm_pass_list);
+
+	run_test_list_ctx(gcc_libstdc);
+	run_test_list_ctx(llvm_pass_list);
+
+	run_test_list_batch(gcc_libstdc);
+	run_test_list_batch(llvm_pass_list);
+
+	run_test_list_arena(gcc_libstdc);
+	run_test_list_arena(llvm_pass_list);
+
+	run_test_list_cache(gcc_libstdc, 0);
+	run_test_list_cache(llvm_pass_list, 0);
+	run_test_list_cache(gcc_libstdc, 16 * 1024);
+
+	run_test_list_cxa(gcc_libstdc);
+	run_test_list_cxa(llvm_pass_list);
+	run_test_cxa_status();
+
+	run_test_fwd();
+
+	test_list_t *lists[] = { gcc_libstdc, llvm_pass_list };
+	run_test_is_mangled(lists, sizeof (lists) / sizeof (lists[0]));
+
 	run_fail(llvm_fail);
 	run_fp(llvm_fp);
 